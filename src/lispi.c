@@ -1,4 +1,16 @@
 #include "mpc.h" 
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+
+#define LISPI_VERSION "0.0.1.0"
+
+// AVX2 vector kernels on x86, unless built with LVEC_SCALAR
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(LVEC_SCALAR)
+#define LVEC_AVX2
+#include <immintrin.h>
+#endif
 
 // Define a macro to control errors(error handling)
 #define LASSERT(args, cond, fmt, ...) \
@@ -6,19 +18,44 @@
 					lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
 
 #define LASSERT_TYPE(func, args, index, expect)	\
-				LASSERT(args, args->cell[index]->type == expect, \
+				LASSERT(args, LVAL_TYPE(args->cell[index]) == expect, \
 						"Function '%s' passed incorrect type for argument %d. Got %s, Expected %s.", \
-						func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+						func, index, ltype_name(LVAL_TYPE(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
 				LASSERT(args, args->count == num, \
 						"Function '%s' passed incorrect number of arguments. Got %d, Expected %d.", \
 						func, args->count, num)
 
+#define LASSERT_NUMS(func, args) \
+				for (int i = 0; i < args->count; ++i) { \
+					LASSERT(args, LVAL_IS_NUMBER(args->cell[i]), \
+						"Function '%s' passed incorrect type for argument %d. Got %s, Expected %s.", \
+						func, i, ltype_name(LVAL_TYPE(args->cell[i])), ltype_name(LVAL_NUM)); }
+
 #define LASSERT_NOT_EMPTY(func, args, index) \
 				LASSERT(args, args->cell[index]->count != 0, \
 						"Function '%s' passed {} for argument %d.", func, index);
 
+// The same checks for builtins taking an argument vector, which only
+// borrow their arguments so have nothing to delete
+#define LASSERTV(cond, fmt, ...) \
+				if (!(cond)) { return lval_err(fmt, ##__VA_ARGS__); }
+
+#define LASSERTV_NUM(func, argc, num) \
+				LASSERTV(argc == num, \
+						"Function '%s' passed incorrect number of arguments. Got %d, Expected %d.", \
+						func, argc, num)
+
+#define LASSERTV_SOME(func, argc) \
+				LASSERTV(argc > 0, "Function '%s' passed no arguments.", func)
+
+#define LASSERTV_NUMS(func, argc, argv) \
+				for (int i = 0; i < argc; ++i) { \
+					LASSERTV(LVAL_IS_NUMBER(argv[i]), \
+						"Function '%s' passed incorrect type for argument %d. Got %s, Expected %s.", \
+						func, i, ltype_name(LVAL_TYPE(argv[i])), ltype_name(LVAL_NUM)); }
+
 
 // If we are compiling on Windows
 #if defined _WIN64 || _WIN32
@@ -47,66 +84,192 @@ void add_history(char* unused) {}
 #define strcpy_s(a, b, c) (strcpy((a), (c)))
 #include <editline/readline.h>
 #include <editline/history.h>
-#endif
 
-// Parsers
-mpc_parser_t* Number;
-mpc_parser_t* Operator;
-mpc_parser_t* String;
-mpc_parser_t* Comment;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* Lispi;
+// Loaded files are read straight out of a mapping
+#define LREAD_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // Forward Declaration(Prototypes)
 struct lval;
 struct lenv;
+struct lcode;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
 
 
 // Create enumerations of possible lval struct types
 enum { LVAL_ERR, LVAL_NUM, LVAL_OPR, LVAL_STR,
-	LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+	LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_VEC, LVAL_DBL };
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+// Builtins may also take their arguments as a vector they borrow, saving
+// the argument list when the caller has them in an array already
+typedef lval*(*lbuiltinv)(lenv*, int, lval**);
 
-// Declare a new struct LVAL
-struct lval {
-	int type;
-	long num;
+// Small numbers are stored directly in the lval pointer with the low bit set
+// (a fixnum), only numbers outside that range are allocated as LVAL_NUM.
+// Those too big for a long are bignums.
+#define LVAL_FIX_MIN (INTPTR_MIN >> 1)
+#define LVAL_FIX_MAX (INTPTR_MAX >> 1)
+#define LVAL_IS_FIX(v) (((uintptr_t)(v)) & 1)
+#define LVAL_FIX(x) ((lval*)((((uintptr_t)(intptr_t)(x)) << 1) | 1))
 
-	// Error and Symbol(operator) types have some string data
-	char* err;
-	char* opr;
-	char* str;
+// Type and number of any lval, fixnum or not
+#define LVAL_TYPE(v) (LVAL_IS_FIX(v) ? LVAL_NUM : (v)->type)
+#define LVAL_LONG(v) (LVAL_IS_FIX(v) ? (long)(((intptr_t)(v)) >> 1) : (v)->num)
+#define LVAL_IS_BIG(v) (!LVAL_IS_FIX(v) && (v)->type == LVAL_NUM && (v)->limbs)
+#define LVAL_IS_LONG(v) (LVAL_IS_FIX(v) || ((v)->type == LVAL_NUM && !(v)->limbs))
 
-	// Function
-	lbuiltin builtin;
-	lenv* env;
-	lval* formals;
-	lval* body;
+// Integers and doubles both count as numbers to arithmetic
+#define LVAL_IS_NUMBER(v) (LVAL_TYPE(v) == LVAL_NUM || LVAL_TYPE(v) == LVAL_DBL)
 
-	// Count and Pointer to a list of "lval*"
-	int count;
-	lval** cell;
+// Order two numbers exactly with a C comparison operator, NaN is unordered
+#define LNUM_ORD(x, y, op) (lnum_ord(x, y) op 0)
+
+// Lists that are slice views of another list's cells
+#define LVAL_IS_VIEW(v) \
+	(((v)->type == LVAL_SEXPR || (v)->type == LVAL_QEXPR) && (v)->base)
+
+
+// Declare a new struct LVAL
+// Only the fields of the variant selected by type are valid, and only
+// that much space is allocated (see lval_size).
+// Values are reference counted and shared by lval_copy, anything about to
+// be modified must first be made unique with lval_own (copy-on-write).
+struct lval {
+	unsigned char type;
+	unsigned char flags;
+	int refs;
+
+	union {
+		// Number, a bignum has a sign and magnitude too and its 'num' is
+		// clamped to LONG_MIN or LONG_MAX
+		struct {
+			long num;
+			int neg;
+			int nlimbs;
+			uint32_t* limbs;
+		};
+
+		double dbl;
+
+		// Error and String types have some string data
+		char* err;
+		char* str;
+
+		// Operator strings are interned so they compare by pointer,
+		// their hash is precomputed. An operator naming a formal of the
+		// lambda it is in knows the slot that formal is bound in, or -1.
+		struct {
+			char* opr;
+			unsigned long hash;
+			int slot;
+		};
+
+		// Function, with the compiled body once the VM has run it. The
+		// arity is -1 unless the formals are distinct and have no '&'.
+		// Builtins that can take an argument vector have it as 'call',
+		// their 'builtin' is the adapter taking an argument list.
+		struct {
+			lbuiltin builtin;
+			lbuiltinv call;
+			lenv* env;
+			lval* formals;
+			lval* body;
+			lcode* code;
+			int arity;
+		};
+
+		// Packed vector of 64 bit integers
+		struct {
+			long len;
+			int64_t* data;
+		};
+
+		// Count, capacity and Pointer to a list of "lval*", a slice view
+		// shares the cells of its base list instead and has no capacity
+		struct {
+			int count;
+			int cap;
+			lval** cell;
+			lval* base;
+		};
+	};
 };
 
 
 // Declare a new struct lenv
+// Entries are stored densely in insertion order, once the environment
+// grows past LENV_LINEAR_MAX an open-addressing index over the entries
+// (keyed on the precomputed operator hashes) is used for lookups.
+// Operator keys are interned strings.
 struct lenv {
 	lenv* par;
+	int flags;
 	int count;
+	int cap;
 	char** oprs;
+	unsigned long* hashes;
 	lval** vals;
+
+	// Open-addressing index into the entries, -1 marks an empty slot
+	int* index;
+	int icap;
 };
 
+// Compiled function body for the bytecode VM
+struct lcode {
+	int refs;
+
+	// Instructions with their operands inline
+	int count;
+	int cap;
+	int* ops;
+
+	// Constants and operators referred to by the instructions
+	int nconsts;
+	int capconsts;
+	lval** consts;
+
+	// Stack needed, and arguments taken if the function is simple
+	int depth;
+	int maxdepth;
+	int arity;
+};
+
+struct lvm {
+	int enabled;
+	lval** stack;
+	int sp;
+	int cap;
+
+	// The innermost run of code in progress
+	struct lvm_roots* runs;
+};
+
+struct lvm lvm = { 0, NULL, 0, 0, NULL };
+
+#define LENV_LINEAR_MAX 8
+
+// Calls with up to this many parts are evaluated into an array on the C
+// stack rather than into a copy of their expression
+#define LARGS_MAX 8
+
+// Flags of lval and lenv objects
+#define LFLAG_MARK 1
+#define LFLAG_NURSERY 2
+#define LFLAG_DEAD 4
+#define LFLAG_CHAIN 8
+
 // Prototypes necessary
 void lval_print(lval* v);
 lval* lval_add(lval* v, lval* x);
-lval* builtin_op(lenv* e, lval* a, char* op);
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
 lval* lval_eval(lenv* e, lval* v);
@@ -114,1400 +277,7349 @@ lval* lval_join(lval* x, lval* y);
 void lval_del(lval* v);
 lval* lval_err(char* fmt, ...);
 lval* lval_copy(lval* v);
+lval* lval_own(lval* v);
+lval* lval_promote(lval* v);
+lval* lval_opr_n(char* s, size_t n);
+void lcode_del(lcode* c);
+void lgc_mark_code(lcode* c);
+void lgc_mark_vm(void);
+void lgc_mark_cek(void);
+void lvm_compile_fun(lval* f);
+lval* lvm_run(lcode* c, lenv* e);
+lval* lvm_eval(lenv* e, lval* v);
 char* ltype_name(int t);
 lval* builtin_def(lenv* e, lval* a);
 lval* lval_call(lenv* e, lval* f, lval* a);
+lval* lval_bind(lenv* e, lval* f, lval* a);
+lval* lval_invoke(lenv* e, lval* v);
+int lval_eq(lval* x, lval* y);
+int lnum_cmp(lval* x, lval* y);
+double lnum_ord(lval* x, lval* y);
+double ldbl_of(lval* v);
 lval* builtin_var(lenv* e, lval* a, char* func);
 lval* builtin_load(lenv* e, lval* a);
 lval* builtin_error(lenv* e, lval* a);
 lval* builtin_print(lenv* e, lval* a);
+lval* builtin_mem_stats(lenv* e, lval* a);
+
+
+// Size-class slab allocator
+// Blocks of up to LSLAB_MAX bytes are carved out of LSLAB_BYTES slabs and
+// recycled through a free list per 8 byte size class, so every lval
+// variant, lenv and small cell array gets its own list. Anything larger
+// goes straight to malloc.
+#define LSLAB_MAX 512
+#define LSLAB_BYTES 65536
+#define LSLAB_CLASSES (LSLAB_MAX / 8 + 1)
+
+// Round a size up to its 8 byte size class
+#define LSLAB_ROUND(n) (((n) + 7) & ~(size_t)7)
+
+struct lpool {
+	void* free;
+	char* next;
+	char* end;
+	long allocs;
+	long frees;
+};
 
+struct lpool lpools[LSLAB_CLASSES];
 
-// Creates a new lenv
-lenv* lenv_new(void)
-{
-	lenv* e = malloc(sizeof(lenv));
-	e->par = NULL;
-	e->count = 0;
-	e->oprs = NULL;
-	e->vals = NULL;
-	return e;
-}
+// Every slab ever allocated, chained through its first word
+void* lslabs = NULL;
+long lslab_count = 0;
 
-// Delete a lenv
-void lenv_del(lenv* e)
+// Counters for the kinds of objects allocated
+enum { LMEM_LVAL, LMEM_LENV, LMEM_CELL, LMEM_KINDS };
+
+struct lmem_stat {
+	long allocs;
+	long frees;
+	long bytes;
+};
+
+struct lmem_stat lmem_stats[LMEM_KINDS];
+
+// Allocate size bytes from the slab of its size class
+void* lmem_alloc(int kind, size_t size)
 {
-	for (int i = 0; i < e->count; ++i)
+	if (size == 0)
 	{
-		free(e->oprs[i]);
-		lval_del(e->vals[i]);
+		return NULL;
 	}
 
-	free(e->oprs);
-	free(e->vals);
-	free(e);
-}
+	lmem_stats[kind].allocs++;
+	lmem_stats[kind].bytes += size;
 
-// Find the correct environment 
-lval* lenv_get(lenv* e, lval* k)
-{
-	// iterate over all the items in the environment
-	for (int i = 0; i < e->count; ++i)
+	if (size > LSLAB_MAX)
 	{
-		// Check if the input string matches any operator string
-		if (strcmp(e->oprs[i], k->opr) == 0)
-		{
-			// Return a copy of the value
-			return lval_copy(e->vals[i]);
-		}
+		return malloc(size);
 	}
 
-	// If no operator check in parent otherwise error
-	if (e->par)
+	size_t csize = LSLAB_ROUND(size);
+	struct lpool* p = &lpools[csize / 8];
+	p->allocs++;
+
+	// Reuse a freed block if there is one
+	if (p->free)
 	{
-		return lenv_get(e->par, k);
+		void* x = p->free;
+		p->free = *(void**)x;
+		return x;
 	}
-	else
+
+	// Otherwise carve a new block, starting a new slab when needed
+	if (p->next + csize > p->end)
 	{
-		// If no symbol found
-		return lval_err("Unbound operator '%s'!", k->opr);
+		char* slab = malloc(LSLAB_BYTES);
+		*(void**)slab = lslabs;
+		lslabs = slab;
+		lslab_count++;
+
+		p->next = slab + 16;
+		p->end = slab + LSLAB_BYTES;
 	}
-	
+
+	void* x = p->next;
+	p->next += csize;
+	return x;
 }
 
-// Puts a new variable provided by the user at the old position
-void lenv_put(lenv* e, lval* k, lval* v)
+// Return a block to the free list of its size class
+void lmem_free(int kind, void* x, size_t size)
 {
-	// Iterate over all items in the environment
-	for (int i = 0; i < e->count; ++i)
+	if (!x)
 	{
-		// If a variable is found delete that
-		if (strcmp(e->oprs[i], k->opr) == 0)
-		{
-			lval_del(e->vals[i]);
-			e->vals[i] = lval_copy(v);
-			return;
-		}
+		return;
 	}
 
-	// If no existing  entry were found allocate space for new entry
-	e->count++;
-	e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-	e->oprs = realloc(e->oprs, sizeof(char*) * e->count);
+	lmem_stats[kind].frees++;
+	lmem_stats[kind].bytes -= size;
 
-	// Copy the contents of lval and operator strings to a new location.
-	e->vals[e->count - 1] = lval_copy(v);
-	e->oprs[e->count - 1] = malloc(strlen(k->opr) + 1);
-	strcpy_s(e->oprs[e->count - 1], (strlen(k->opr) + 1), k->opr);
-}
-
-// Function for copying environments
-lenv* lenv_copy(lenv* e)
-{
-	lenv* n = malloc(sizeof(lenv));
-	n->par = e->par;
-	n->count = e->count;
-	n->oprs = malloc(sizeof(char*) * n->count);
-	n->vals = malloc(sizeof(lval*) * n->count);
-	for (int i = 0; i < e->count; ++i)
+	if (size > LSLAB_MAX)
 	{
-		n->oprs[i] = malloc(strlen(e->oprs[i]) + 1);
-		strcpy_s(n->oprs[i], (strlen(e->oprs[i])+ 1), e->oprs[i]);
-		n->vals[i] = lval_copy(e->vals[i]);
+		free(x);
+		return;
 	}
 
-	return n;
+	struct lpool* p = &lpools[LSLAB_ROUND(size) / 8];
+	p->frees++;
+	*(void**)x = p->free;
+	p->free = x;
 }
 
-// Declare a variable in the outermost(global) context
-void lenv_def(lenv* e, lval* k, lval* v)
+// Resize a block, moving it between size classes
+void* lmem_realloc(int kind, void* x, size_t oldsize, size_t newsize)
 {
-	// Iterate till e has no parent
-	while (e->par)
+	if (x && oldsize > LSLAB_MAX && newsize > LSLAB_MAX)
 	{
-		e = e->par;
+		lmem_stats[kind].bytes += newsize - oldsize;
+		return realloc(x, newsize);
 	}
-	lenv_put(e, k, v);
-}
-
 
-
-// Declare a new number type lval
-lval* lval_num(long x)
-{
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_NUM;
-	v->num = x;
-	return v;
+	void* y = lmem_alloc(kind, newsize);
+	if (x)
+	{
+		memcpy(y, x, min(oldsize, newsize));
+		lmem_free(kind, x, oldsize);
+	}
+	return y;
 }
 
-// Create a new error type lval
-lval* lval_err(char* fmt, ...)
-{
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_ERR;
 
-	// Create a va list and initialize it
-	va_list va;
-	va_start(va, fmt);
+// Optional tracing garbage collector
+// When enabled lval_del and lenv_del do nothing, every lval and lenv is
+// recorded in a registry instead, and unreachable objects are swept at
+// safe points once LGC_THRESHOLD objects were allocated since the last
+// collection. Roots are the environment being evaluated in and its
+// parents, the variables pushed on the root stacks by evaluations in
+// progress, and the stacks of the VM and the explicit-stack evaluator.
+// Builtins hold values in C variables the collector can't see, so there
+// is no collection while one runs.
+#ifndef LGC_THRESHOLD
+#define LGC_THRESHOLD 100000
+#endif
 
-	// Allocate 512 bytes of space
-	v->err = malloc(512);
-	
-	// printf the error string with a maximum of 511 bytes
-	vsnprintf(v->err, 511, fmt, va);
-	
+struct lgc_root {
+	lval** p;
+	int n;
+};
 
-	// Reallocate to number of bytes actually used
-	v->err = realloc(v->err, strlen(v->err) + 1);
+struct lgc_heap {
+	int enabled;
+	long collections;
+	long allocs;
+	long threshold;
 
-	// Clean up our va list
-	va_end(va);	
+	// Registries of every object allocated
+	lval** vals;
+	long nvals;
+	long capvals;
+	lenv** envs;
+	long nenvs;
+	long capenvs;
+
+	// Addresses of variables holding values and environments in use, so
+	// whatever they hold when a collection happens is kept
+	struct lgc_root* roots;
+	int nroots;
+	int caproots;
+	lenv*** envroots;
+	int nenvroots;
+	int capenvroots;
+};
 
-	return v;
-}
+struct lgc_heap lgc = { 0, 0, 0, LGC_THRESHOLD };
 
+// Depth of builtin calls in progress, collecting is only safe outside them
+int lcall_depth = 0;
 
-// Construct a pointer to a new operator lval
-lval* lval_opr(char* s)
+// Record new objects in the registries
+void lgc_register_lval(lval* v)
 {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_OPR;
-	v->opr = malloc(strlen(s) + 1);
-	strcpy_s(v->opr, (strlen(s) + 1), s);
-	return v;
+	if (lgc.nvals == lgc.capvals)
+	{
+		lgc.capvals = lgc.capvals ? lgc.capvals * 2 : 1024;
+		lgc.vals = realloc(lgc.vals, sizeof(lval*) * lgc.capvals);
+	}
+	lgc.vals[lgc.nvals++] = v;
+	lgc.allocs++;
 }
 
-// Construct a pointer to chars(string)
-lval* lval_str(char* s)
+void lgc_register_lenv(lenv* e)
 {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_STR;
-	v->str = malloc(strlen(s) + 1);
-	strcpy_s(v->str, (strlen(s) + 1), s);
-	return v;
+	if (lgc.nenvs == lgc.capenvs)
+	{
+		lgc.capenvs = lgc.capenvs ? lgc.capenvs * 2 : 1024;
+		lgc.envs = realloc(lgc.envs, sizeof(lenv*) * lgc.capenvs);
+	}
+	lgc.envs[lgc.nenvs++] = e;
+	lgc.allocs++;
 }
 
-
-// A pointer to a new empty Sexpr lavl
-lval* lval_sexpr(void)
+// Root 'n' variables from 'p' on, any of them may be NULL
+void lgc_push_roots(lval** p, int n)
 {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_SEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
+	if (!lgc.enabled)
+	{
+		return;
+	}
+	if (lgc.nroots == lgc.caproots)
+	{
+		lgc.caproots = lgc.caproots ? lgc.caproots * 2 : 16;
+		lgc.roots = realloc(lgc.roots, sizeof(struct lgc_root) * lgc.caproots);
+	}
+	lgc.roots[lgc.nroots].p = p;
+	lgc.roots[lgc.nroots].n = n;
+	lgc.nroots++;
 }
 
-// A pointer to a new empty Sexpr lavl
-lval* lval_qexpr(void)
+void lgc_push_root(lval** p)
 {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_QEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
+	lgc_push_roots(p, 1);
 }
 
-// Create new function
-lval* lval_builtin(lbuiltin func)
+void lgc_pop_root(void)
 {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_FUN;
-	v->builtin = func;
-	return v;
+	if (lgc.enabled)
+	{
+		lgc.nroots--;
+	}
 }
 
-
-
-// Function to delete(free) lval* to avoid memory leaks
-void lval_del(lval* v)
+// Root an environment variable, its parents are kept too
+void lgc_push_env(lenv** e)
 {
-	switch (v->type)
+	if (!lgc.enabled)
 	{
-	case LVAL_NUM:
-		break;								// Do nothing for numbers
-	case LVAL_FUN:
-		if (!v->builtin)
-		{
-			lenv_del(v->env);
-			lval_del(v->formals);
-			lval_del(v->body);
-		}
-		break;
-	// For error and operator type free them
-	case LVAL_ERR:
-		free(v->err);
-		break;
-	case LVAL_OPR:
-		free(v->opr);
-		break;
-	case LVAL_STR:
-		free(v->str);
-		break;
-	// For Sexpr or Qexpr delete(free) all the elements inside
-	case LVAL_QEXPR:
-	case LVAL_SEXPR:
-		for (int i = 0; i < v->count; ++i)
-		{
-			lval_del(v->cell[i]);			// Free every pointer in the cell
-		}
-		// Also free the cell containing the pointers
-		free(v->cell);
-		break;
+		return;
+	}
+	if (lgc.nenvroots == lgc.capenvroots)
+	{
+		lgc.capenvroots = lgc.capenvroots ? lgc.capenvroots * 2 : 16;
+		lgc.envroots = realloc(lgc.envroots, sizeof(lenv**) * lgc.capenvroots);
 	}
+	lgc.envroots[lgc.nenvroots++] = e;
+}
 
-	// Free the lvalue struct itself
-	free(v);
+void lgc_pop_env(void)
+{
+	if (lgc.enabled)
+	{
+		lgc.nenvroots--;
+	}
 }
 
-// Copy lvals
-lval* lval_copy(lval* v)
+
+// Nursery for evaluation temporaries
+// While a top-level form is evaluated new lvals are bump allocated from
+// LNURSERY_CHUNK sized chunks. Freeing one only marks it dead, and the
+// whole nursery is reset once the form has been evaluated. Values stored
+// in the global environment are promoted (copied out) first, as they are
+// the only ones that outlive the form.
+#define LNURSERY_CHUNK (1 << 20)
+
+struct lchunk {
+	struct lchunk* next;
+	char* top;
+};
+
+struct lnursery {
+	int enabled;
+	int active;
+	struct lchunk* first;
+	struct lchunk* cur;
+	long live;
+	long allocs;
+	long promoted;
+	long resets;
+};
+
+struct lnursery lnursery = { 0, 0, NULL, NULL };
+
+// Start of the allocations of a chunk
+#define LCHUNK_DATA(c) ((char*)(c) + sizeof(struct lchunk))
+
+// Bump allocate from the nursery
+void* lnursery_alloc(size_t size)
 {
-	lval* x = malloc(sizeof(lval));
-	x->type = v->type;
+	// Keep every allocation aligned like the slabs do
+	size = LSLAB_ROUND(size);
 
-	// Copy functions and numbers directly
-	switch (v->type)
+	struct lchunk* c = lnursery.cur;
+	while (!c || c->top + size > (char*)c + LNURSERY_CHUNK)
 	{
-	case LVAL_FUN:
-		if (v->builtin)
-		{
-			x->builtin = v->builtin;
-		}
-		else
-		{
-			x->builtin = NULL;
-			x->env = lenv_copy(v->env);
-			x->formals = lval_copy(v->formals);
-			x->body = lval_copy(v->body);
-		}
-		break;
-	case LVAL_NUM:
-		x->num = v->num;
-		break;
-
-	// Copy strings using malloc and strcpy
-	case LVAL_ERR:
-		x->err = malloc(strlen(v->err) + 1);
-		strcpy_s(x->err, (strlen(v->err) + 1), v->err);
-		break;
-	case LVAL_OPR:
-		x->opr = malloc(strlen(v->opr) + 1);
-		strcpy_s(x->opr, (strlen(v->opr) + 1), v->opr);
-		break;
-	case LVAL_STR:
-		x->str = malloc(strlen(v->str) + 1);
-		strcpy_s(x->str, (strlen(v->str) + 1), v->str);
-		break;
-	case LVAL_SEXPR:
-	case LVAL_QEXPR:
-		x->count = v->count;
-		x->cell = malloc(sizeof(lval*) * x->count);
-		for (int i = 0; i < x->count; ++i)
+		// Move on to the next chunk, adding one at the end if needed
+		struct lchunk* n = c ? c->next : lnursery.first;
+		if (!n)
 		{
-			x->cell[i] = lval_copy(v->cell[i]);
+			n = malloc(LNURSERY_CHUNK);
+			n->next = NULL;
+			n->top = LCHUNK_DATA(n);
+			if (c)
+			{
+				c->next = n;
+			}
+			else
+			{
+				lnursery.first = n;
+			}
 		}
-		break;
+		c = lnursery.cur = n;
 	}
 
+	void* x = c->top;
+	c->top += size;
+	lnursery.live++;
+	lnursery.allocs++;
 	return x;
 }
 
 
-// add add two lval* increment the count realloc the cell, point the cell
-lval* lval_add(lval* v, lval* x)
+// Hash an operator string (FNV-1a)
+unsigned long lhash(char* s, size_t n)
 {
-	v->count++;
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-	v->cell[v->count - 1] = x;
-	return v;
+	unsigned long h = 2166136261UL;
+	for (size_t i = 0; i < n; ++i)
+	{
+		h ^= (unsigned char)s[i];
+		h *= 16777619UL;
+	}
+	return h;
 }
 
+// Process wide table of interned operator strings
+struct lsymtab {
+	int count;
+	int cap;
+	char** names;
+	unsigned long* hashes;
+};
 
-// lval* pops out the value at index i
-lval* lval_pop(lval* v, int i)
-{
-	// Find the element at i
-	lval* x = v->cell[i];
-
-	// Shift memory after the element at i over the top
-	memmove(&v->cell[i],
-		&v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
-
-	// Decrease the count of the items in the list
-	v->count--;
+struct lsymtab lsyms = { 0, 0, NULL, NULL };
 
-	// Reallocate the memory used
-	v->cell = realloc(v->cell, sizeof(lval*) * (v->count));
-	return x;
-}
+// Interned operators used by the evaluator itself
+char* lsym_amp;
 
-// deletes(takes) the element and deletes the rest of the list
-lval* lval_take(lval* v, int i)
+// Insert an already interned name into the table slots
+void lsym_insert(char* name, unsigned long h)
 {
-	lval* x = lval_pop(v, i);
-	lval_del(v);
-	return x;
+	int mask = lsyms.cap - 1;
+	int j = (int)(h & mask);
+	while (lsyms.names[j])
+	{
+		j = (j + 1) & mask;
+	}
+	lsyms.names[j] = name;
+	lsyms.hashes[j] = h;
 }
 
-// A constructor for user defined lval functions
-lval* lval_lambda(lval* formals, lval* body)
+// Return the unique copy of the operator string of n characters at s,
+// which needn't be terminated, creating it if needed
+char* lsym_intern(char* s, size_t n, unsigned long h)
 {
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_FUN;
+	if (lsyms.cap)
+	{
+		int mask = lsyms.cap - 1;
+		for (int j = (int)(h & mask); lsyms.names[j]; j = (j + 1) & mask)
+		{
+			if (lsyms.hashes[j] == h && strncmp(lsyms.names[j], s, n) == 0 && lsyms.names[j][n] == '\0')
+			{
+				return lsyms.names[j];
+			}
+		}
+	}
 
-	v->builtin = NULL;
-	v->env = lenv_new();
+	// Grow the table keeping the load factor under half
+	if ((lsyms.count + 1) * 2 > lsyms.cap)
+	{
+		int oldcap = lsyms.cap;
+		char** oldnames = lsyms.names;
+		unsigned long* oldhashes = lsyms.hashes;
+
+		lsyms.cap = oldcap ? oldcap * 2 : 256;
+		lsyms.names = calloc(lsyms.cap, sizeof(char*));
+		lsyms.hashes = malloc(sizeof(unsigned long) * lsyms.cap);
+		for (int j = 0; j < oldcap; ++j)
+		{
+			if (oldnames[j])
+			{
+				lsym_insert(oldnames[j], oldhashes[j]);
+			}
+		}
+		free(oldnames);
+		free(oldhashes);
+	}
 
-	v->formals = formals;
-	v->body = body;
-	return v;
+	char* name = malloc(n + 1);
+	memcpy(name, s, n);
+	name[n] = '\0';
+	lsym_insert(name, h);
+	lsyms.count++;
+	return name;
 }
 
-// Add a builtin for our lambda function
-lval* builtin_lambda(lenv* e, lval* a)
+// Creates a new lenv
+lenv* lenv_new(void)
 {
-	// Check parameters to make sure only Q-Expressions
-	LASSERT_NUM("\\", a, 2);
-	LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-	LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+	lenv* e = lmem_alloc(LMEM_LENV, sizeof(lenv));
+	e->par = NULL;
+	e->flags = 0;
+	e->count = 0;
+	e->cap = 0;
+	e->oprs = NULL;
+	e->hashes = NULL;
+	e->vals = NULL;
+	e->index = NULL;
+	e->icap = 0;
 
-	// Check first Q-Expression contains only operators
-	for (int i = 0; i < a->cell[0]->count; ++i)
+	if (lgc.enabled)
 	{
-		LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_OPR),
-			"Cannot define non-operator! Got %s, Expected %s.", 
-			ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_OPR));
+		lgc_register_lenv(e);
 	}
+	return e;
+}
 
-	// Pop the first two arguments and pass them to lval_lambda
-	lval* formals = lval_pop(a, 0);
-	lval* body = lval_pop(a, 0);
-	lval_del(a);
+// Call frames
+// Environments with room for up to LFRAME_MAX entries are kept when freed,
+// arrays and all, on a free list per capacity (chained through 'par').
+// Calls take their environment from here, so in steady state binding a
+// function's arguments allocates nothing.
+#define LFRAME_MAX 8
+#define LFRAME_KEEP 64
+
+struct lframes {
+	lenv* free[LFRAME_MAX + 1];
+	int count[LFRAME_MAX + 1];
+	long reused;
+};
 
-	return lval_lambda(formals, body);
-}
+struct lframes lframes;
 
-// Print out the Sub expressions line by line
-void lval_expr_print(lval* v, char open, char close)
+// An empty environment with room for n entries
+lenv* lenv_frame(int n)
 {
-	putchar(open);
-	for (int i = 0; i < v->count; ++i)
+	for (int c = n; c <= LFRAME_MAX; ++c)
 	{
-
-		// Print value contained within
-		lval_print(v->cell[i]);
-
-		// Avoid printing trailing space if last element
-		if (i != (v->count - 1))
+		lenv* e = lframes.free[c];
+		if (e)
 		{
-			putchar(' ');
+			lframes.free[c] = e->par;
+			lframes.count[c]--;
+			lframes.reused++;
+			e->par = NULL;
+			e->flags = 0;
+			e->count = 0;
+			if (lgc.enabled)
+			{
+				lgc_register_lenv(e);
+			}
+			return e;
 		}
 	}
 
-	putchar(close);
+	lenv* e = lenv_new();
+	if (n > 0)
+	{
+		e->oprs = lmem_alloc(LMEM_LENV, sizeof(char*) * n);
+		e->hashes = lmem_alloc(LMEM_LENV, sizeof(unsigned long) * n);
+		e->vals = lmem_alloc(LMEM_LENV, sizeof(lval*) * n);
+		e->cap = n;
+	}
+	return e;
 }
 
-// Print a string unescaped
-void lval_print_str(lval* v)
+// Free the storage of a lenv without touching its values
+void lenv_free(lenv* e)
 {
-	// Make a copy of the string
-	char* escaped = malloc(strlen(v->str) + 1);
-	strcpy_s(escaped, (strlen(v->str) + 1), v->str);
-	
-	// Pass it through the escape function
-	escaped = mpcf_escape(escaped);
+	// Keep small environments for later calls
+	if (e->cap <= LFRAME_MAX && !e->index && lframes.count[e->cap] < LFRAME_KEEP)
+	{
+		e->par = lframes.free[e->cap];
+		lframes.free[e->cap] = e;
+		lframes.count[e->cap]++;
+		return;
+	}
 
-	// Print it between ""
-	printf("\"%s\"", escaped);
-	
-	// Free the copied string
-	free(escaped);
+	lmem_free(LMEM_LENV, e->oprs, sizeof(char*) * e->cap);
+	lmem_free(LMEM_LENV, e->hashes, sizeof(unsigned long) * e->cap);
+	lmem_free(LMEM_LENV, e->vals, sizeof(lval*) * e->cap);
+	lmem_free(LMEM_LENV, e->index, sizeof(int) * e->icap);
+	lmem_free(LMEM_LENV, e, sizeof(lenv));
 }
 
-
-// Print an "lval"
-void lval_print(lval* v)
+// Delete a lenv
+void lenv_del(lenv* e)
 {
-	switch (v->type)
+	// Left to the collector
+	if (lgc.enabled)
 	{
-	case LVAL_FUN:
-		if (v->builtin)
-		{
-			printf("<builtin>");
-		}
-		else
-		{
-			printf("\\ ");
-			lval_print(v->formals);
-			putchar(' ');
-			lval_print(v->body);
-			putchar(')');
-		}
-		break;
-	case LVAL_NUM:
-		printf("%li", v->num);
-		break;
-	case LVAL_ERR:
-		printf("Error: %s", v->err);
-		break;
-	case LVAL_OPR:
-		printf("%s", v->opr);
-		break;
-	case LVAL_STR:
-		lval_print_str(v);
-		break;
-	case LVAL_SEXPR:
-		lval_expr_print(v, '(', ')');
-		break;
-	case LVAL_QEXPR:
-		lval_expr_print(v, '{', '}');
-		break;
+		return;
 	}
-}
 
+	for (int i = 0; i < e->count; ++i)
+	{
+		lval_del(e->vals[i]);
+	}
+	lenv_free(e);
+}
 
-// Print an "lval" followed by a newline character.
-void lval_println(lval* v)
+// Insert entry i into the index of the environment
+void lenv_index_insert(lenv* e, int i)
 {
-	lval_print(v);
-	putchar('\n');
+	int mask = e->icap - 1;
+	int j = (int)(e->hashes[i] & mask);
+	while (e->index[j] != -1)
+	{
+		j = (j + 1) & mask;
+	}
+	e->index[j] = i;
 }
 
-// Check if two values for equality
-int lval_eq(lval* x, lval* y)
+// Rebuild the index with a capacity that keeps the load factor under half
+void lenv_reindex(lenv* e)
 {
-	// Different type are always equal
-	if (x->type != y->type)
+	int icap = 16;
+	while (icap < e->count * 2)
 	{
-		return 0;
+		icap *= 2;
 	}
-	
-	// Compare based upton type
-	switch (x->type)
-	{
-	case LVAL_NUM:
-		return (x->num == y->num);
-	
-	// Compare string values
-	case LVAL_ERR:
-		return (strcmp(x->err, y->err) == 0);
-	case LVAL_OPR:
-		return (strcmp(x->opr, y->opr) == 0);
-	case LVAL_STR:
-		return (strcmp(x->str, y->str) == 0);
 
-	// If builtin compare, otherwise compare formals and body
-	case LVAL_FUN:
-		if (x->builtin || y->builtin)
-		{
-			return x->builtin == y->builtin;
-		}
-		else
-		{
-			return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
-		}
+	lmem_free(LMEM_LENV, e->index, sizeof(int) * e->icap);
+	e->icap = icap;
+	e->index = lmem_alloc(LMEM_LENV, sizeof(int) * icap);
+	for (int i = 0; i < icap; ++i)
+	{
+		e->index[i] = -1;
+	}
+	for (int i = 0; i < e->count; ++i)
+	{
+		lenv_index_insert(e, i);
+	}
+}
 
-	// If list compare every individual element
-	case LVAL_QEXPR:
-	case LVAL_SEXPR:
-		if (x->count != y->count)
-		{
-			return 0;
-		}
-		for (int i = 0; i < x->count; ++i)
+// Find the entry of an operator in this environment only, -1 if not found
+int lenv_find(lenv* e, lval* k)
+{
+	// Small environments are scanned directly
+	if (!e->index)
+	{
+		for (int i = 0; i < e->count; ++i)
 		{
-			// If any element not equal then whole list is not equal
-			if (!lval_eq(x->cell[i], y->cell[i]))
+			if (e->oprs[i] == k->opr)
 			{
-				return 0;
+				return i;
 			}
 		}
-		
-		// Otherwise must be equal
-		return 1;
-		break;	
+		return -1;
 	}
 
-	return 0;
+	// Otherwise probe the index starting at the operator hash
+	int mask = e->icap - 1;
+	for (int j = (int)(k->hash & mask); e->index[j] != -1; j = (j + 1) & mask)
+	{
+		int i = e->index[j];
+		if (e->oprs[i] == k->opr)
+		{
+			return i;
+		}
+	}
+	return -1;
 }
 
-// Generate builtins for logical operators like and, or and not!
-lval* builtin_logop(lenv* e, lval* a, char* op)
+// Find the correct environment 
+lval* lenv_get(lenv* e, lval* k)
 {
-	if ((strcmp(op, "not") == 0) && (a->count == 2))
+	// A formal of the running function is in its known slot, keys are
+	// unique so a match there is the entry a search would find
+	int i = k->slot;
+	if (i >= 0 && i < e->count && e->oprs[i] == k->opr)
 	{
-		LASSERT_NUM(op, a, 1);
+		return lval_copy(e->vals[i]);
 	}
-	if ((strcmp(op, "not") != 0) && (a->count != 2))
+
+	// Check this environment and then each parent in turn
+	for (; e; e = e->par)
 	{
-		LASSERT_NUM(op, a, 2);
+		int i = lenv_find(e, k);
+		if (i != -1)
+		{
+			// Return a copy of the value
+			return lval_copy(e->vals[i]);
+		}
 	}
 
+	// If no symbol found
+	return lval_err("Unbound operator '%s'!", k->opr);
+}
 
-	int r = 0;
-	if (strcmp(op, "and") == 0)
+// Puts a new variable provided by the user at the old position
+void lenv_put(lenv* e, lval* k, lval* v)
+{
+	// Globals outlive the nursery
+	v = lval_copy(v);
+	if (lnursery.enabled && !e->par)
 	{
-		r = (a->cell[0]->num && a->cell[1]->num);
+		v = lval_promote(v);
 	}
-	if (strcmp(op, "or") == 0)
+
+	// If a variable is found replace it
+	int i = lenv_find(e, k);
+	if (i != -1)
 	{
-		r = (a->cell[0]->num || a->cell[1]->num);
+		lval_del(e->vals[i]);
+		e->vals[i] = v;
+		return;
 	}
-	if (strcmp(op, "not") == 0)
+
+	// If no existing entry were found make space for new entry
+	if (e->count == e->cap)
 	{
-		r = !(a->cell[0]->num);
+		int cap = e->cap ? e->cap * 2 : 4;
+		e->oprs = lmem_realloc(LMEM_LENV, e->oprs, sizeof(char*) * e->cap, sizeof(char*) * cap);
+		e->hashes = lmem_realloc(LMEM_LENV, e->hashes, sizeof(unsigned long) * e->cap, sizeof(unsigned long) * cap);
+		e->vals = lmem_realloc(LMEM_LENV, e->vals, sizeof(lval*) * e->cap, sizeof(lval*) * cap);
+		e->cap = cap;
 	}
 
-	lval_del(a);
-	return lval_num(r);
-}
-
+	// Store the lval and share the interned operator string
+	i = e->count++;
+	e->vals[i] = v;
+	e->hashes[i] = k->hash;
+	e->oprs[i] = k->opr;
 
-// Generate builtins for comparisons like == and !=
-lval* builtin_cmp(lenv* e, lval* a, char* op)
-{
-	LASSERT_NUM(op, a, 2);
-	int r = 0;
-	if (strcmp(op, "==") == 0)
+	// Keep the index in step once the environment is large enough
+	if (e->index && e->count * 2 <= e->icap)
 	{
-		r = lval_eq(a->cell[0], a->cell[1]);
+		lenv_index_insert(e, i);
 	}
-	if (strcmp(op, "!=") == 0)
+	else if (e->count > LENV_LINEAR_MAX)
 	{
-		r = !lval_eq(a->cell[0], a->cell[1]);
+		lenv_reindex(e);
 	}
-
-	lval_del(a);
-	return lval_num(r);
 }
 
-// Generate builtins for oders such as >, <, >= and <=
-lval* builtin_ord(lenv* e, lval* a, char* op)
+// Bind copies of n values to distinct operators in an empty environment,
+// so entry i is ks[i] and nothing needs searching for
+void lenv_bind(lenv* e, lval** ks, lval** vs, int n)
 {
-	LASSERT_NUM(op, a, 2);
-	LASSERT_TYPE(op, a, 0, LVAL_NUM);
-	LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-	int r = 0;
-	if (strcmp(op, ">") == 0)
-	{
-		r = (a->cell[0]->num > a->cell[1]->num);
-	}
-	if (strcmp(op, "<") == 0)
+	if (n > e->cap)
 	{
-		r = (a->cell[0]->num < a->cell[1]->num);
+		e->oprs = lmem_realloc(LMEM_LENV, e->oprs, sizeof(char*) * e->cap, sizeof(char*) * n);
+		e->hashes = lmem_realloc(LMEM_LENV, e->hashes, sizeof(unsigned long) * e->cap, sizeof(unsigned long) * n);
+		e->vals = lmem_realloc(LMEM_LENV, e->vals, sizeof(lval*) * e->cap, sizeof(lval*) * n);
+		e->cap = n;
 	}
-	if (strcmp(op, ">=") == 0)
+
+	for (int i = 0; i < n; ++i)
 	{
-		r = (a->cell[0]->num >= a->cell[1]->num);
+		// Globals outlive the nursery
+		lval* v = lval_copy(vs[i]);
+		if (lnursery.enabled && !e->par)
+		{
+			v = lval_promote(v);
+		}
+		e->vals[i] = v;
+		e->hashes[i] = ks[i]->hash;
+		e->oprs[i] = ks[i]->opr;
 	}
-	if (strcmp(op, "<=") == 0)
+	e->count = n;
+
+	if (n > LENV_LINEAR_MAX)
 	{
-		r = (a->cell[0]->num <= a->cell[1]->num);
+		lenv_reindex(e);
 	}
-
-	lval_del(a);
-	return lval_num(r);
 }
 
-// Generate a builtin for if
-lval* builtin_if(lenv* e, lval* a)
+// Function for copying environments
+lenv* lenv_copy(lenv* e)
 {
-	LASSERT_NUM("if", a, 3);
-	LASSERT_TYPE("if", a, 0, LVAL_NUM);
-	LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
-	LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
-
-	// Mark both Expressions evaluable
-	lval* x;
-	a->cell[1]->type = LVAL_SEXPR;
-	a->cell[2]->type = LVAL_SEXPR;
-
-	if (a->cell[0]->num)
+	lenv* n = lmem_alloc(LMEM_LENV, sizeof(lenv));
+	n->par = e->par;
+	n->flags = 0;
+	n->count = e->count;
+	n->cap = e->count;
+	n->oprs = lmem_alloc(LMEM_LENV, sizeof(char*) * n->count);
+	n->hashes = lmem_alloc(LMEM_LENV, sizeof(unsigned long) * n->count);
+	n->vals = lmem_alloc(LMEM_LENV, sizeof(lval*) * n->count);
+	for (int i = 0; i < e->count; ++i)
 	{
-		// If condition is true evaluate first expression
-		x = lval_eval(e, lval_pop(a, 1));
+		n->oprs[i] = e->oprs[i];
+		n->hashes[i] = e->hashes[i];
+		n->vals[i] = lval_copy(e->vals[i]);
 	}
-	else
+
+	// Share nothing with the original index
+	n->icap = e->icap;
+	n->index = NULL;
+	if (e->index)
 	{
-		// Otherwise evaluate second expression
-		x = lval_eval(e, lval_pop(a, 2));
+		n->index = lmem_alloc(LMEM_LENV, sizeof(int) * n->icap);
+		memcpy(n->index, e->index, sizeof(int) * n->icap);
 	}
 
-	// Delete the argument list and return
-	lval_del(a);
-	return x;
-}
-
-
-// Use operator string to see which operator to perform
-lval* builtin_op(lenv* e, lval* a, char* op)
-{
-	// Ensure all arguments are numbers
-	for (int i = 0; i < a->count; ++i)
+	if (lgc.enabled)
 	{
-		LASSERT_TYPE(op, a, i, LVAL_NUM);
+		lgc_register_lenv(n);
 	}
+	return n;
+}
 
-	// Pop the first element
-	lval* x = lval_pop(a, 0);
-
-	// If no arguments and subtract then perform unary negation
-	if ((strcmp(op, "-") == 0) && a->count == 0)
+// Declare a variable in the outermost(global) context
+void lenv_def(lenv* e, lval* k, lval* v)
+{
+	// Iterate till e has no parent
+	while (e->par)
 	{
-		x->num = -x->num;
+		e = e->par;
 	}
+	lenv_put(e, k, v);
+}
 
-	// While there are still elements remaining
-	while (a->count > 0)
+// Whether every operator in 'x' is also bound in 'e', so nothing can be
+// looked up through 'x' from an environment below 'e'
+int lenv_covers(lenv* e, lenv* x)
+{
+	lval k;
+	for (int i = 0; i < x->count; ++i)
 	{
-		// Pop the next element
-		lval* y = lval_pop(a, 0);
-
-
-		if (strcmp(op, "+") == 0)
-		{
-			x->num += y->num;
-		}
-		if (strcmp(op, "-") == 0)
-		{
-			x->num -= y->num;
-		}
-		if (strcmp(op, "*") == 0)
-		{
-			x->num *= y->num;
-		}
-		if (strcmp(op, "/") == 0)
-		{
-			if (y->num == 0)
-			{
-				lval_del(x);
-				lval_del(y);
-				x = lval_err("Division By Zero!");
-				break;
-			}
-			x->num /= y->num;
-		}
-		if (strcmp(op, "%") == 0)
-		{
-			x->num %= y->num;
-		}
-		if (strcmp(op, "^") == 0)
-		{
-			x->num = (long)pow(x->num, y->num);
-		}
-		if (strcmp(op, "min") == 0)
-		{
-			x->num = min(x->num, y->num);
-		}
-		if (strcmp(op, "max") == 0)
+		k.opr = x->oprs[i];
+		k.hash = x->hashes[i];
+		if (lenv_find(e, &k) == -1)
 		{
-			x->num = max(x->num, y->num);
+			return 0;
 		}
-
-		lval_del(y);
 	}
-
-	// Delete the input expression and return the result
-	lval_del(a);
-	return x;
+	return 1;
 }
 
-// builtin mathematical functions
-lval* builtin_add(lenv* e, lval* a)
+
+
+// Number of bytes used by an lval of the given type
+size_t lval_size(int type)
 {
-	return builtin_op(e, a, "+");
+	switch (type)
+	{
+	case LVAL_NUM:
+		return offsetof(lval, limbs) + sizeof(uint32_t*);
+	case LVAL_ERR:
+		return offsetof(lval, err) + sizeof(char*);
+	case LVAL_STR:
+		return offsetof(lval, str) + sizeof(char*);
+	case LVAL_OPR:
+		return offsetof(lval, slot) + sizeof(int);
+	case LVAL_FUN:
+		return offsetof(lval, arity) + sizeof(int);
+	case LVAL_VEC:
+		return offsetof(lval, data) + sizeof(int64_t*);
+	case LVAL_DBL:
+		return offsetof(lval, dbl) + sizeof(double);
+	default:
+		return offsetof(lval, base) + sizeof(lval*);
+	}
 }
 
-lval* builtin_sub(lenv* e, lval* a)
+// Allocate an lval sized for its type
+lval* lval_alloc(int type)
 {
-	return builtin_op(e, a, "-");
+	lval* v;
+	if (lnursery.active)
+	{
+		v = lnursery_alloc(lval_size(type));
+		v->flags = LFLAG_NURSERY;
+	}
+	else
+	{
+		v = lmem_alloc(LMEM_LVAL, lval_size(type));
+		v->flags = 0;
+	}
+	v->type = type;
+	v->refs = 1;
+
+	if (lgc.enabled)
+	{
+		lgc_register_lval(v);
+	}
+	return v;
 }
 
-lval* builtin_mul(lenv* e, lval* a)
+// Return an lval to the allocator, under the collector it is swept instead
+// and nursery values are only marked dead until the nursery is reset
+void lval_free(lval* v)
 {
-	return builtin_op(e, a, "*");
+	if (lgc.enabled)
+	{
+		return;
+	}
+	if (v->flags & LFLAG_NURSERY)
+	{
+		v->flags |= LFLAG_DEAD;
+		lnursery.live--;
+		return;
+	}
+	lmem_free(LMEM_LVAL, v, lval_size(v->type));
 }
 
-lval* builtin_div(lenv* e, lval* a)
+// Declare a new number type lval
+lval* lval_num(long x)
 {
-	return builtin_op(e, a, "/");
+	// Most numbers need no allocation at all
+	if (x >= LVAL_FIX_MIN && x <= LVAL_FIX_MAX)
+	{
+		return LVAL_FIX(x);
+	}
+
+	lval* v = lval_alloc(LVAL_NUM);
+	v->num = x;
+	v->limbs = NULL;
+	return v;
 }
 
-lval* builtin_mod(lenv* e, lval* a)
+// Declare a new double type lval
+lval* lval_dbl(double x)
 {
-	return builtin_op(e, a, "%");
+	lval* v = lval_alloc(LVAL_DBL);
+	v->dbl = x;
+	return v;
 }
 
-lval* builtin_pow(lenv* e, lval* a)
+// Arbitrary precision integers
+// A bignum's magnitude is kept in 32 bit limbs, least significant first and
+// without leading zeros. Arithmetic on longs checks for overflow and only
+// then redoes the operation on bignums. A result that fits in a long
+// always goes back to being a plain number.
+
+// Operands with at least this many limbs are multiplied with Karatsuba
+#ifndef LBIG_KARATSUBA
+#define LBIG_KARATSUBA 32
+#endif
+
+// Overflow checked arithmetic on longs, true if the result doesn't fit
+#if defined(__GNUC__)
+#define lnum_add_ovf(x, y, r) __builtin_add_overflow(x, y, r)
+#define lnum_sub_ovf(x, y, r) __builtin_sub_overflow(x, y, r)
+#define lnum_mul_ovf(x, y, r) __builtin_mul_overflow(x, y, r)
+#else
+int lnum_add_ovf(long x, long y, long* r)
 {
-	return builtin_op(e, a, "^");
+	if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y))
+	{
+		return 1;
+	}
+	*r = x + y;
+	return 0;
 }
 
-lval* builtin_min(lenv* e, lval* a)
+int lnum_sub_ovf(long x, long y, long* r)
 {
-	return builtin_op(e, a, "min");
+	if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y))
+	{
+		return 1;
+	}
+	*r = x - y;
+	return 0;
 }
 
-lval* builtin_max(lenv* e, lval* a)
+int lnum_mul_ovf(long x, long y, long* r)
 {
-	return builtin_op(e, a, "max");
+	if (x > 0 ? (y > 0 ? x > LONG_MAX / y : y < LONG_MIN / x)
+		: (y > 0 ? x < LONG_MIN / y : (x != 0 && y < LONG_MAX / x)))
+	{
+		return 1;
+	}
+	*r = x * y;
+	return 0;
 }
+#endif
 
-lval* builtin_def(lenv* e, lval* a)
+// A bignum being worked on, the limbs are either borrowed from an lval or
+// a long, or owned by whoever made it
+typedef struct {
+	int neg;
+	int n;
+	uint32_t* d;
+} lbig;
+
+// Length of a magnitude without its leading zeros
+int lmag_len(uint32_t* a, int n)
 {
-	return builtin_var(e, a, "def");
+	while (n > 0 && a[n - 1] == 0)
+	{
+		n--;
+	}
+	return n;
 }
 
-lval* builtin_put(lenv* e, lval* a)
+int lmag_cmp(uint32_t* a, int an, uint32_t* b, int bn)
 {
-	return builtin_var(e, a, "=");
+	if (an != bn)
+	{
+		return an < bn ? -1 : 1;
+	}
+	for (int i = an - 1; i >= 0; --i)
+	{
+		if (a[i] != b[i])
+		{
+			return a[i] < b[i] ? -1 : 1;
+		}
+	}
+	return 0;
 }
 
-lval* builtin_gt(lenv* e, lval* a)
+// r = a + b, r has room for max(an, bn) + 1 limbs
+void lmag_add(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn)
 {
-	return builtin_ord(e, a, ">");
+	if (an < bn)
+	{
+		uint32_t* t = a; a = b; b = t;
+		int tn = an; an = bn; bn = tn;
+	}
+
+	uint64_t c = 0;
+	int i = 0;
+	for (; i < bn; ++i)
+	{
+		c += (uint64_t)a[i] + b[i];
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	for (; i < an; ++i)
+	{
+		c += a[i];
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	r[i] = (uint32_t)c;
 }
 
-lval* builtin_lt(lenv* e, lval* a)
+// r = a - b where a >= b, r has room for an limbs and may be a
+void lmag_sub(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn)
 {
-	return builtin_ord(e, a, "<");
+	uint64_t borrow = 0;
+	for (int i = 0; i < an; ++i)
+	{
+		uint64_t t = (uint64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+		r[i] = (uint32_t)t;
+		borrow = t >> 63;
+	}
 }
 
-lval* builtin_ge(lenv* e, lval* a)
+// r += a, the sum fits in the rn limbs of r
+void lmag_addto(uint32_t* r, int rn, uint32_t* a, int an)
 {
-	return builtin_ord(e, a, ">=");
+	uint64_t c = 0;
+	int i = 0;
+	for (; i < an; ++i)
+	{
+		c += (uint64_t)r[i] + a[i];
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	for (; c && i < rn; ++i)
+	{
+		c += r[i];
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
 }
 
-lval* builtin_le(lenv* e, lval* a)
+// r = a * b by long multiplication, r is zeroed and has an + bn limbs
+void lmag_mul_long(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn)
 {
-	return builtin_ord(e, a, "<=");
+	for (int i = 0; i < an; ++i)
+	{
+		uint64_t c = 0;
+		for (int j = 0; j < bn; ++j)
+		{
+			c += (uint64_t)a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t)c;
+			c >>= 32;
+		}
+		r[i + bn] = (uint32_t)c;
+	}
 }
 
-lval* builtin_eq(lenv* e, lval* a)
+// r = a * b, r is zeroed and has an + bn limbs. Large operands are split
+// in halves a = a1 B^h + a0 and b = b1 B^h + b0, and the middle part
+// a0 b1 + a1 b0 is found as (a0 + a1)(b0 + b1) - a0 b0 - a1 b1, so three
+// multiplications of half the size are needed instead of four.
+void lmag_mul(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn)
 {
-	return builtin_cmp(e, a, "==");
+	if (an < bn)
+	{
+		uint32_t* t = a; a = b; b = t;
+		int tn = an; an = bn; bn = tn;
+	}
+	if (bn < LBIG_KARATSUBA)
+	{
+		lmag_mul_long(r, a, an, b, bn);
+		return;
+	}
+
+	// Very different lengths, multiply b by pieces of a as long as it
+	if (2 * bn <= an)
+	{
+		uint32_t* t = malloc(sizeof(uint32_t) * 2 * bn);
+		for (int i = 0; i < an; i += bn)
+		{
+			int k = min(bn, an - i);
+			memset(t, 0, sizeof(uint32_t) * (k + bn));
+			lmag_mul(t, a + i, k, b, bn);
+			lmag_addto(r + i, an + bn - i, t, k + bn);
+		}
+		free(t);
+		return;
+	}
+
+	// a0 b0 and a1 b1 go straight into their places in r
+	int h = an / 2;
+	lmag_mul(r, a, h, b, h);
+	lmag_mul(r + 2 * h, a + h, an - h, b + h, bn - h);
+
+	uint32_t* sa = malloc(sizeof(uint32_t) * (an - h + 1));
+	uint32_t* sb = malloc(sizeof(uint32_t) * (an - h + 1));
+	lmag_add(sa, a, h, a + h, an - h);
+	lmag_add(sb, b, h, b + h, bn - h);
+	int san = lmag_len(sa, an - h + 1);
+	int sbn = lmag_len(sb, max(h, bn - h) + 1);
+
+	int mn = san + sbn;
+	uint32_t* m = calloc(mn + 1, sizeof(uint32_t));
+	lmag_mul(m, sa, san, sb, sbn);
+	lmag_sub(m, m, mn, r, lmag_len(r, 2 * h));
+	lmag_sub(m, m, mn, r + 2 * h, lmag_len(r + 2 * h, an + bn - 2 * h));
+	lmag_addto(r + h, an + bn - h, m, lmag_len(m, mn));
+
+	free(sa);
+	free(sb);
+	free(m);
 }
 
-lval* builtin_ne(lenv* e, lval* a)
+// a = a / d, returning the remainder
+uint32_t lmag_divsmall(uint32_t* a, int n, uint32_t d)
 {
-	return builtin_cmp(e, a, "!=");
+	uint64_t r = 0;
+	for (int i = n - 1; i >= 0; --i)
+	{
+		uint64_t x = (r << 32) | a[i];
+		a[i] = (uint32_t)(x / d);
+		r = x % d;
+	}
+	return (uint32_t)r;
 }
 
-lval* builtin_and(lenv* e, lval* a)
+// q = a / b and r = a % b, one bit at a time. q has room for an limbs
+// and r for bn + 1.
+void lmag_divmod(uint32_t* q, uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn)
 {
-	return builtin_logop(e, a, "and");
+	memset(q, 0, sizeof(uint32_t) * an);
+	memset(r, 0, sizeof(uint32_t) * (bn + 1));
+	for (long i = (long)an * 32 - 1; i >= 0; --i)
+	{
+		// Shift the next bit of a into r
+		for (int j = bn; j > 0; --j)
+		{
+			r[j] = (r[j] << 1) | (r[j - 1] >> 31);
+		}
+		r[0] = (r[0] << 1) | ((a[i / 32] >> (i % 32)) & 1);
+
+		if (lmag_cmp(r, lmag_len(r, bn + 1), b, bn) >= 0)
+		{
+			lmag_sub(r, r, bn + 1, b, bn);
+			q[i / 32] |= (uint32_t)1 << (i % 32);
+		}
+	}
 }
 
-lval* builtin_or(lenv* e, lval* a)
+// View a long as a bignum, 'buf' holds its limbs
+lbig lbig_long(long l, uint32_t* buf)
 {
-	return builtin_logop(e, a, "or");
+	lbig x;
+	unsigned long long m = l < 0 ? 0ULL - (unsigned long long)l : (unsigned long long)l;
+	x.neg = l < 0;
+	x.n = 0;
+	x.d = buf;
+	while (m)
+	{
+		buf[x.n++] = (uint32_t)m;
+		m >>= 32;
+	}
+	return x;
 }
 
-lval* builtin_not(lenv* e, lval* a)
+// View any number as a bignum, 'buf' holds the limbs of a long
+lbig lbig_of(lval* v, uint32_t* buf)
 {
-	return builtin_logop(e, a, "not");
+	if (LVAL_IS_BIG(v))
+	{
+		lbig x;
+		x.neg = v->neg;
+		x.n = v->nlimbs;
+		x.d = v->limbs;
+		return x;
+	}
+	return lbig_long(LVAL_LONG(v), buf);
 }
 
+// A copy with its own limbs
+lbig lbig_copy(lbig x)
+{
+	lbig r = x;
+	r.d = malloc(sizeof(uint32_t) * (x.n + 1));
+	memcpy(r.d, x.d, sizeof(uint32_t) * x.n);
+	return r;
+}
 
-// Return a string of the type expected
-char* ltype_name(int t)
+lbig lbig_add(lbig x, lbig y)
 {
-	switch (t)
+	int n = max(x.n, y.n) + 1;
+	lbig r;
+	r.d = malloc(sizeof(uint32_t) * n);
+	if (x.neg == y.neg)
 	{
-	case LVAL_FUN:
-		return "Function";
-	case LVAL_NUM:
-		return "Number";
-	case LVAL_ERR:
-		return "Error";
-	case LVAL_OPR:
-		return "Operator";
-	case LVAL_STR:
-		return "String";
-	case LVAL_SEXPR:
-		return "S-Expression";
-	case LVAL_QEXPR:
-		return "Q-Expression";
-	default:
-		return "Unknown";
+		lmag_add(r.d, x.d, x.n, y.d, y.n);
+		r.neg = x.neg;
+	}
+	else if (lmag_cmp(x.d, x.n, y.d, y.n) >= 0)
+	{
+		r.d[n - 1] = 0;
+		lmag_sub(r.d, x.d, x.n, y.d, y.n);
+		r.neg = x.neg;
+	}
+	else
+	{
+		r.d[n - 1] = 0;
+		lmag_sub(r.d, y.d, y.n, x.d, x.n);
+		r.neg = y.neg;
 	}
+	r.n = lmag_len(r.d, n);
+	return r;
 }
 
-// return an lval* of head from an Qexpr
-lval* builtin_head(lenv* e, lval* a)
+lbig lbig_mul(lbig x, lbig y)
 {
-	// Check possible error conditions
-	LASSERT_NUM("head", a, 1);
-
-	LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
-
-	LASSERT_NOT_EMPTY("head", a, 0);
+	lbig r;
+	r.d = calloc(x.n + y.n + 1, sizeof(uint32_t));
+	lmag_mul(r.d, x.d, x.n, y.d, y.n);
+	r.n = lmag_len(r.d, x.n + y.n);
+	r.neg = x.neg != y.neg;
+	return r;
+}
 
-	// Otherwise take first argument
-	lval* v = lval_take(a, 0);
+// Quotient or remainder, truncating like C does. y is not zero.
+lbig lbig_div(lbig x, lbig y, int rem)
+{
+	uint32_t* q = malloc(sizeof(uint32_t) * (x.n + 1));
+	uint32_t* m = malloc(sizeof(uint32_t) * (y.n + 1));
+	lmag_divmod(q, m, x.d, x.n, y.d, y.n);
 
-	// Delete all elements that are not head and return
-	while (v->count > 1)
+	lbig r;
+	if (rem)
 	{
-		lval_del(lval_pop(v, 1));
+		free(q);
+		r.d = m;
+		r.n = lmag_len(m, y.n + 1);
+		r.neg = x.neg;
 	}
-
-	return v;
+	else
+	{
+		free(m);
+		r.d = q;
+		r.n = lmag_len(q, x.n);
+		r.neg = x.neg != y.neg;
+	}
+	return r;
 }
 
-// return an lval* of head from an Qexpr
-lval* builtin_tail(lenv* e, lval* a)
+// Turn a bignum into a number, taking its limbs
+lval* lval_big(lbig x)
 {
-	// Check possible error conditions
-	LASSERT_NUM("tail", a, 1);
-
-	LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
+	x.n = lmag_len(x.d, x.n);
 
-	LASSERT_NOT_EMPTY("tail", a, 0);
-
-	// Otherwise take first argument
-	lval* v = lval_take(a, 0);
-
-	// Delete first element and return
-	lval_del(lval_pop(v, 0));
+	// Back to a long if it fits
+	if (x.n * 32 <= (int)(sizeof(unsigned long long) * CHAR_BIT))
+	{
+		unsigned long long m = 0;
+		for (int i = x.n - 1; i >= 0; --i)
+		{
+			m = (m << 32) | x.d[i];
+		}
+		if (m <= (unsigned long long)LONG_MAX || (x.neg && m == (unsigned long long)LONG_MAX + 1))
+		{
+			free(x.d);
+			return lval_num(x.neg ? (long)(0ULL - m) : (long)m);
+		}
+	}
 
+	lval* v = lval_alloc(LVAL_NUM);
+	v->num = x.neg ? LONG_MIN : LONG_MAX;
+	v->neg = x.neg;
+	v->nlimbs = x.n;
+	v->limbs = x.d;
 	return v;
 }
 
-// Converts S-Expression into Q-Expression
-lval* builtin_list(lenv* e, lval* a)
-{
-	a->type = LVAL_QEXPR;
-	return a;
-}
-
-// Converts Q-Expression into S-Expression and evaluates using lval_eval()
-lval* builtin_eval(lenv* e, lval* a)
+// Read a number of any size from its decimal digits
+lval* lval_big_read(char* s)
 {
-	LASSERT_NUM("eval", a, 1);
+	int neg = *s == '-';
+	s += neg;
 
-	LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+	size_t len = strlen(s);
+	lbig x;
+	x.neg = neg;
+	x.n = 0;
+	x.d = calloc(len / 9 + 2, sizeof(uint32_t));
 
+	// Nine digits at a time, x = x * 10^k + digits
+	while (*s)
+	{
+		uint32_t chunk = 0;
+		uint32_t scale = 1;
+		for (int k = 0; k < 9 && *s; ++k, ++s)
+		{
+			chunk = chunk * 10 + (uint32_t)(*s - '0');
+			scale *= 10;
+		}
 
-	lval* x = lval_take(a, 0);
-	x->type = LVAL_SEXPR;
-	return lval_eval(e, x);
+		uint64_t c = chunk;
+		for (int i = 0; i < x.n; ++i)
+		{
+			c += (uint64_t)x.d[i] * scale;
+			x.d[i] = (uint32_t)c;
+			c >>= 32;
+		}
+		if (c)
+		{
+			x.d[x.n++] = (uint32_t)c;
+		}
+	}
+	return lval_big(x);
 }
 
-// Joins Q-Expressions and returns a Q-Expression
-lval* builtin_join(lenv* e, lval* a)
+// Compare two numbers of any size
+int lnum_cmp(lval* x, lval* y)
 {
-	for (int i = 0; i < a->count; ++i)
+	if (!LVAL_IS_BIG(x) && !LVAL_IS_BIG(y))
 	{
-		LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+		long a = LVAL_LONG(x);
+		long b = LVAL_LONG(y);
+		return (a > b) - (a < b);
 	}
 
-	lval* x = lval_pop(a, 0);
-
-	while (a->count)
+	uint32_t xb[2], yb[2];
+	lbig a = lbig_of(x, xb);
+	lbig b = lbig_of(y, yb);
+	if (a.neg != b.neg)
 	{
-		lval* y = lval_pop(a, 0);
-		x = lval_join(x, y);
+		return a.neg ? -1 : 1;
 	}
-
-	lval_del(a);
-	return x;
+	int c = lmag_cmp(a.d, a.n, b.d, b.n);
+	return a.neg ? -c : c;
 }
 
-// Joins 2 Q-Exressions to one Q-Expression
-lval* lval_join(lval* x, lval* y)
+// A number as a double. Bignums are rounded from their top 96 bits and
+// become infinities if too large.
+double ldbl_of(lval* v)
 {
-	// For each cell in 'y' add it to 'x'
-	for (int i = 0; i < y->count; ++i)
+	if (LVAL_TYPE(v) == LVAL_DBL)
 	{
-		x = lval_add(x, y->cell[i]);
+		return v->dbl;
 	}
-
-	// Delete the empty 'y' and return 'x'
-	free(y->cell);
-	free(y);
-	return x;
+	if (!LVAL_IS_BIG(v))
+	{
+		return (double)LVAL_LONG(v);
+	}
+
+	int k = v->nlimbs > 3 ? v->nlimbs - 3 : 0;
+	double x = 0;
+	for (int i = v->nlimbs - 1; i >= k; --i)
+	{
+		x = x * 4294967296.0 + v->limbs[i];
+	}
+	x = ldexp(x, 32 * k);
+	return v->neg ? -x : x;
 }
 
-// Evaluate a Sexpr and return a lval*
-lval* lval_eval_sexpr(lenv* e, lval* v)
+// An integral double as an integer of any size
+lval* lval_dbl_int(double x)
 {
+	if (x >= (double)LONG_MIN && x < -(double)LONG_MIN)
+	{
+		return lval_num((long)x);
+	}
 
-	// Evaluate children
-	for (int i = 0; i < v->count; ++i)
+	// |x| = mant 2^(e - 53), and e is at least 64 here
+	int e;
+	uint64_t mant = (uint64_t)ldexp(frexp(fabs(x), &e), 53);
+	lbig b;
+	b.neg = x < 0;
+	b.n = e / 32 + 1;
+	b.d = calloc(b.n, sizeof(uint32_t));
+	for (int i = 0; i < 53; ++i)
 	{
-		v->cell[i] = lval_eval(e, v->cell[i]);
+		if ((mant >> i) & 1)
+		{
+			int bit = i + e - 53;
+			b.d[bit / 32] |= (uint32_t)1 << (bit % 32);
+		}
 	}
+	return lval_big(b);
+}
 
-	// Error checking
-	for (int i = 0; i < v->count; ++i)
+// Compare two numbers of any kind exactly. The result is -1, 0 or 1, or
+// NaN if either is NaN, so comparing it with 0 orders x and y as C would
+// without ever rounding an integer to a double.
+double lnum_ord(lval* x, lval* y)
+{
+	int dx = LVAL_TYPE(x) == LVAL_DBL;
+	int dy = LVAL_TYPE(y) == LVAL_DBL;
+	if (!dx && !dy)
+	{
+		return lnum_cmp(x, y);
+	}
+	if (dx && dy)
+	{
+		return isnan(x->dbl) || isnan(y->dbl) ? NAN : (x->dbl > y->dbl) - (x->dbl < y->dbl);
+	}
+
+	// A double d against an integer, flipped back if the double is y
+	double d = dx ? x->dbl : y->dbl;
+	lval* n = dx ? y : x;
+	int c;
+	if (isnan(d))
+	{
+		return NAN;
+	}
+	if (isinf(d))
+	{
+		c = d > 0 ? 1 : -1;
+	}
+	else
 	{
-		if (v->cell[i]->type == LVAL_ERR)
+		// The integer part decides, or else the fraction does
+		double t = trunc(d);
+		lval* i = lval_dbl_int(t);
+		c = lnum_cmp(i, n);
+		lval_del(i);
+		if (c == 0)
 		{
-			return lval_take(v, i);
+			c = (d > t) - (d < t);
 		}
 	}
+	return dx ? c : -c;
+}
 
-	// Empty Expression
-	if (v->count == 0)
+// Create a new error type lval
+lval* lval_err(char* fmt, ...)
+{
+	lval* v = lval_alloc(LVAL_ERR);
+
+	// Create a va list and initialize it
+	va_list va;
+	va_start(va, fmt);
+
+	// Allocate 512 bytes of space
+	v->err = malloc(512);
+	
+	// printf the error string with a maximum of 511 bytes
+	vsnprintf(v->err, 511, fmt, va);
+	
+
+	// Reallocate to number of bytes actually used
+	v->err = realloc(v->err, strlen(v->err) + 1);
+
+	// Clean up our va list
+	va_end(va);	
+
+	return v;
+}
+
+
+// Construct a pointer to a new operator lval
+lval* lval_opr(char* s)
+{
+	return lval_opr_n(s, strlen(s));
+}
+
+// The operator named by n characters at s, which needn't be terminated
+lval* lval_opr_n(char* s, size_t n)
+{
+	lval* v = lval_alloc(LVAL_OPR);
+	v->hash = lhash(s, n);
+	v->opr = lsym_intern(s, n, v->hash);
+	v->slot = -1;
+	return v;
+}
+
+// Construct a pointer to chars(string)
+lval* lval_str(char* s)
+{
+	lval* v = lval_alloc(LVAL_STR);
+	v->str = malloc(strlen(s) + 1);
+	strcpy_s(v->str, (strlen(s) + 1), s);
+	return v;
+}
+
+// Construct a vector of 'n' numbers, the contents are left to the caller.
+// Returns an error if there is no room for that many.
+lval* lval_vec(long n)
+{
+	int64_t* data = n <= (long)(SIZE_MAX / sizeof(int64_t)) ? malloc(sizeof(int64_t) * (n ? n : 1)) : NULL;
+	if (!data)
+	{
+		return lval_err("Could not allocate a vector of %li numbers.", n);
+	}
+
+	lval* v = lval_alloc(LVAL_VEC);
+	v->len = n;
+	v->data = data;
+	return v;
+}
+
+
+// A pointer to a new empty Sexpr lavl
+lval* lval_sexpr(void)
+{
+	lval* v = lval_alloc(LVAL_SEXPR);
+	v->count = 0;
+	v->cap = 0;
+	v->cell = NULL;
+	v->base = NULL;
+	return v;
+}
+
+// A pointer to a new empty Sexpr lavl
+lval* lval_qexpr(void)
+{
+	lval* v = lval_alloc(LVAL_QEXPR);
+	v->count = 0;
+	v->cap = 0;
+	v->cell = NULL;
+	v->base = NULL;
+	return v;
+}
+
+// Returns the 'n' elements of a list starting at 'i' without copying them.
+// The result is a view sharing the cells of the original list, which is
+// kept alive (and never modified) until the view goes away.
+lval* lval_slice(lval* v, int i, int n)
+{
+	if (i == 0 && n == v->count)
 	{
 		return v;
 	}
 
-	// Single Expression
-	if (v->count == 1)
+	// Nothing needs to be kept for an empty list
+	if (n == 0)
 	{
-		return lval_take(v, 0);
+		lval* x = v->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+		lval_del(v);
+		return x;
 	}
 
-	// Ensure first element is symbol
-	lval* f = lval_pop(v, 0);
-	if (f->type != LVAL_FUN)
+	// A view nobody else refers to can just be narrowed
+	if (v->base && v->refs == 1)
 	{
-		lval* err = lval_err("S-Expression starts with incorrect type! Got %s, Expected %s.", 
-			ltype_name(f->type), ltype_name(LVAL_FUN));
-		lval_del(f);
+		v->cell += i;
+		v->count = n;
+		return v;
+	}
+
+	lval* x = lval_alloc(v->type);
+	x->count = n;
+	x->cap = 0;
+	x->cell = v->cell + i;
+
+	// Views always refer to the list that owns the cells
+	if (v->base)
+	{
+		x->base = lval_copy(v->base);
 		lval_del(v);
-		return err;
 	}
+	else
+	{
+		x->base = v;
+	}
+	return x;
+}
 
-	// Call builtin with operator
-	lval* result = lval_call(e, f, v);
-	lval_del(f);
-	return result;
+// Create new function
+lval* lval_builtin(lbuiltin func)
+{
+	lval* v = lval_alloc(LVAL_FUN);
+	v->builtin = func;
+	v->call = NULL;
+	return v;
 }
 
-// Add a new function for every operator/function
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func)
+
+
+// Function to delete(free) lval* to avoid memory leaks
+// Drops one reference, the value is freed once nothing refers to it
+void lval_del(lval* v)
 {
-	lval* k = lval_opr(name);
-	lval* v = lval_builtin(func);
-	lenv_put(e, k, v);
-	lval_del(k);
-	lval_del(v);
+	// Fixnums are not allocated, and the collector frees everything else
+	if (LVAL_IS_FIX(v) || lgc.enabled)
+	{
+		return;
+	}
+
+	// Still shared by someone else
+	if (--v->refs > 0)
+	{
+		return;
+	}
+
+	switch (v->type)
+	{
+	case LVAL_NUM:
+		free(v->limbs);						// Only bignums have limbs
+		break;
+	case LVAL_FUN:
+		if (!v->builtin)
+		{
+			lenv_del(v->env);
+			lval_del(v->formals);
+			lval_del(v->body);
+			lcode_del(v->code);
+		}
+		break;
+	// For error and operator type free them
+	case LVAL_ERR:
+		free(v->err);
+		break;
+	case LVAL_OPR:
+		break;								// Operators are interned
+	case LVAL_STR:
+		free(v->str);
+		break;
+	case LVAL_VEC:
+		free(v->data);
+		break;
+	// For Sexpr or Qexpr delete(free) all the elements inside
+	case LVAL_QEXPR:
+	case LVAL_SEXPR:
+		// Views only let go of the list they share
+		if (v->base)
+		{
+			lval_del(v->base);
+			break;
+		}
+		for (int i = 0; i < v->count; ++i)
+		{
+			lval_del(v->cell[i]);			// Free every pointer in the cell
+		}
+		// Also free the cell containing the pointers
+		lmem_free(LMEM_CELL, v->cell, sizeof(lval*) * v->cap);
+		break;
+	}
+
+	// Free the lvalue struct itself
+	lval_free(v);
 }
 
-// Add the new builtins
-void lenv_add_builtins(lenv* e)
+// Copy lvals, this only shares the value with one more reference
+lval* lval_copy(lval* v)
 {
-	// List functions
-	lenv_add_builtin(e, "list", builtin_list);
-	lenv_add_builtin(e, "head", builtin_head);
-	lenv_add_builtin(e, "tail", builtin_tail);
-	lenv_add_builtin(e, "eval", builtin_eval);
-	lenv_add_builtin(e, "join", builtin_join);
+	// Fixnums are copied by value
+	if (!LVAL_IS_FIX(v))
+	{
+		v->refs++;
+	}
+	return v;
+}
 
-	// Mathematical functions
-	lenv_add_builtin(e, "+", builtin_add);
-	lenv_add_builtin(e, "-", builtin_sub);
-	lenv_add_builtin(e, "*", builtin_mul);
-	lenv_add_builtin(e, "/", builtin_div);
-	lenv_add_builtin(e, "%", builtin_mod);
-	lenv_add_builtin(e, "^", builtin_pow);
-	lenv_add_builtin(e, "min", builtin_min);
-	lenv_add_builtin(e, "max", builtin_max);
+// Return a uniquely referenced version of v which may be modified.
+// Shared values and views are copied one level deep, their children are
+// shared.
+lval* lval_own(lval* v)
+{
+	if (LVAL_IS_FIX(v) || (v->refs == 1 && !LVAL_IS_VIEW(v)))
+	{
+		return v;
+	}
 
-	// Variable functions
-	lenv_add_builtin(e, "\\", builtin_lambda);
-	lenv_add_builtin(e, "def", builtin_def);
-	lenv_add_builtin(e, "=", builtin_put);
+	lval* x = lval_alloc(v->type);
 
-	// Comparison functions
-	lenv_add_builtin(e, "if", builtin_if);
-	lenv_add_builtin(e, "==", builtin_eq);
-	lenv_add_builtin(e, "!=", builtin_ne);
-	lenv_add_builtin(e, ">", builtin_gt);
-	lenv_add_builtin(e, "<", builtin_lt);
-	lenv_add_builtin(e, ">=", builtin_ge);
-	lenv_add_builtin(e, "<=", builtin_le);
+	// Copy functions and numbers directly
+	switch (v->type)
+	{
+	case LVAL_FUN:
+		if (v->builtin)
+		{
+			x->builtin = v->builtin;
+			x->call = v->call;
+		}
+		else
+		{
+			x->builtin = NULL;
+			x->call = NULL;
 
-	// Logical Operators
-	lenv_add_builtin(e, "and", builtin_and);
-	lenv_add_builtin(e, "or", builtin_or);
-	lenv_add_builtin(e, "not", builtin_not);
+			// A copy about to be called binds its arguments in a frame
+			if (v->env->count == 0)
+			{
+				x->env = lenv_frame(max(v->arity, 0));
+				x->env->par = v->env->par;
+			}
+			else
+			{
+				x->env = lenv_copy(v->env);
+			}
+			x->formals = lval_copy(v->formals);
+			x->body = lval_copy(v->body);
+			x->code = v->code;
+			x->arity = v->arity;
+			if (x->code)
+			{
+				x->code->refs++;
+			}
+		}
+		break;
+	case LVAL_NUM:
+		x->num = v->num;
+		x->neg = v->neg;
+		x->nlimbs = v->nlimbs;
+		x->limbs = NULL;
+		if (v->limbs)
+		{
+			x->limbs = malloc(sizeof(uint32_t) * v->nlimbs);
+			memcpy(x->limbs, v->limbs, sizeof(uint32_t) * v->nlimbs);
+		}
+		break;
 
-	// String Functions
-	lenv_add_builtin(e, "load", builtin_load);
-	lenv_add_builtin(e, "error", builtin_error);
-	lenv_add_builtin(e, "print", builtin_print);
+	// Copy strings using malloc and strcpy
+	case LVAL_ERR:
+		x->err = malloc(strlen(v->err) + 1);
+		strcpy_s(x->err, (strlen(v->err) + 1), v->err);
+		break;
+	case LVAL_OPR:
+		x->opr = v->opr;
+		x->hash = v->hash;
+		x->slot = v->slot;
+		break;
+	case LVAL_STR:
+		x->str = malloc(strlen(v->str) + 1);
+		strcpy_s(x->str, (strlen(v->str) + 1), v->str);
+		break;
+	case LVAL_DBL:
+		x->dbl = v->dbl;
+		break;
+	case LVAL_VEC:
+		x->len = v->len;
+		x->data = malloc(sizeof(int64_t) * (v->len ? v->len : 1));
+		memcpy(x->data, v->data, sizeof(int64_t) * v->len);
+		break;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		x->count = v->count;
+		x->cap = v->count;
+		x->cell = lmem_alloc(LMEM_CELL, sizeof(lval*) * x->cap);
+		x->base = NULL;
+		for (int i = 0; i < x->count; ++i)
+		{
+			x->cell[i] = lval_copy(v->cell[i]);
+		}
+		break;
+	}
 
+	// Release our reference to the shared original
+	if (v->refs > 1)
+	{
+		v->refs--;
+	}
+	else
+	{
+		lval_del(v);
+	}
+	return x;
+}
+
+
+// Mark everything reachable from an environment or value
+void lgc_mark_env(lenv* e);
+
+void lgc_mark(lval* v)
+{
+	if (LVAL_IS_FIX(v) || (v->flags & LFLAG_MARK))
+	{
+		return;
+	}
+	v->flags |= LFLAG_MARK;
+
+	switch (v->type)
+	{
+	case LVAL_FUN:
+		if (!v->builtin)
+		{
+			lgc_mark_env(v->env);
+			lgc_mark(v->formals);
+			lgc_mark(v->body);
+			lgc_mark_code(v->code);
+		}
+		break;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		if (v->base)
+		{
+			lgc_mark(v->base);
+			break;
+		}
+		for (int i = 0; i < v->count; ++i)
+		{
+			lgc_mark(v->cell[i]);
+		}
+		break;
+	}
+}
+
+// The parent of a function environment is only valid during a call, so
+// parents are not followed
+void lgc_mark_env(lenv* e)
+{
+	if (e->flags & LFLAG_MARK)
+	{
+		return;
+	}
+	e->flags |= LFLAG_MARK;
+
+	for (int i = 0; i < e->count; ++i)
+	{
+		lgc_mark(e->vals[i]);
+	}
+}
+
+// An environment in use and its parents. Once one is reached this way
+// so were its parents, which stops the walk.
+void lgc_mark_chain(lenv* e)
+{
+	for (; e && !(e->flags & LFLAG_CHAIN); e = e->par)
+	{
+		lgc_mark_env(e);
+		e->flags |= LFLAG_CHAIN;
+	}
+}
+
+// Free the storage owned by an unreachable lval, not its children
+void lgc_finalize(lval* v)
+{
+	switch (v->type)
+	{
+	case LVAL_FUN:
+		if (!v->builtin)
+		{
+			lcode_del(v->code);
+		}
+		break;
+	case LVAL_ERR:
+		free(v->err);
+		break;
+	case LVAL_NUM:
+		free(v->limbs);
+		break;
+	case LVAL_STR:
+		free(v->str);
+		break;
+	case LVAL_VEC:
+		free(v->data);
+		break;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		if (!v->base)
+		{
+			lmem_free(LMEM_CELL, v->cell, sizeof(lval*) * v->cap);
+		}
+		break;
+	}
+	lmem_free(LMEM_LVAL, v, lval_size(v->type));
+}
+
+// Mark from the roots and sweep the registries
+void lgc_collect(lenv* e)
+{
+	lgc_mark_chain(e);
+	for (int i = 0; i < lgc.nenvroots; ++i)
+	{
+		lgc_mark_chain(*lgc.envroots[i]);
+	}
+	for (int i = 0; i < lgc.nroots; ++i)
+	{
+		for (int j = 0; j < lgc.roots[i].n; ++j)
+		{
+			lval* v = lgc.roots[i].p[j];
+			if (v)
+			{
+				lgc_mark(v);
+			}
+		}
+	}
+	lgc_mark_vm();
+	lgc_mark_cek();
+
+	long n = 0;
+	for (long i = 0; i < lgc.nvals; ++i)
+	{
+		lval* v = lgc.vals[i];
+		if (v->flags & LFLAG_MARK)
+		{
+			v->flags &= ~LFLAG_MARK;
+			lgc.vals[n++] = v;
+		}
+		else
+		{
+			lgc_finalize(v);
+		}
+	}
+	lgc.nvals = n;
+
+	n = 0;
+	for (long i = 0; i < lgc.nenvs; ++i)
+	{
+		lenv* x = lgc.envs[i];
+		if (x->flags & LFLAG_MARK)
+		{
+			x->flags &= ~(LFLAG_MARK | LFLAG_CHAIN);
+			lgc.envs[n++] = x;
+		}
+		else
+		{
+			lenv_free(x);
+		}
+	}
+	lgc.nenvs = n;
+
+	// Collect again once the heap has grown enough
+	lgc.collections++;
+	lgc.allocs = 0;
+	lgc.threshold = max(LGC_THRESHOLD, 2 * (lgc.nvals + lgc.nenvs));
+}
+
+// Collect if enabled, due, and no builtin is running. 'e' is the
+// environment being evaluated in.
+void lgc_safepoint(lenv* e)
+{
+	if (lgc.enabled && lcall_depth == 0 && lgc.allocs >= lgc.threshold)
+	{
+		lgc_collect(e);
+	}
+}
+
+
+// Make sure nothing reachable from v lives in the nursery, v is consumed
+// and its replacement returned. Children of old values are replaced in
+// place, which is safe as the copies are equal.
+lval* lval_promote(lval* v)
+{
+	if (LVAL_IS_FIX(v))
+	{
+		return v;
+	}
+
+	int young = v->flags & LFLAG_NURSERY;
+	if (young)
+	{
+		// Copy out of the nursery with the children shared
+		int active = lnursery.active;
+		lnursery.active = 0;
+		lval* x = lval_own(lval_copy(v));
+		lnursery.active = active;
+
+		lval_del(v);
+		v = x;
+		lnursery.promoted++;
+	}
+
+	switch (v->type)
+	{
+	case LVAL_FUN:
+		if (!v->builtin)
+		{
+			// Compiled code may refer to young values, compile again later
+			if (young && v->code)
+			{
+				lcode_del(v->code);
+				v->code = NULL;
+			}
+
+			for (int i = 0; i < v->env->count; ++i)
+			{
+				v->env->vals[i] = lval_promote(v->env->vals[i]);
+			}
+			v->formals = lval_promote(v->formals);
+			v->body = lval_promote(v->body);
+		}
+		break;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		for (int i = 0; i < v->count; ++i)
+		{
+			v->cell[i] = lval_promote(v->cell[i]);
+		}
+		break;
+	}
+	return v;
+}
+
+// Free what a value left alive in the nursery still owns
+void lnursery_finalize(lval* v)
+{
+	switch (v->type)
+	{
+	case LVAL_FUN:
+		if (!v->builtin)
+		{
+			lenv_del(v->env);
+			lval_del(v->formals);
+			lval_del(v->body);
+			lcode_del(v->code);
+		}
+		break;
+	case LVAL_ERR:
+		free(v->err);
+		break;
+	case LVAL_NUM:
+		free(v->limbs);
+		break;
+	case LVAL_STR:
+		free(v->str);
+		break;
+	case LVAL_VEC:
+		free(v->data);
+		break;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		if (v->base)
+		{
+			if (!(v->base->flags & LFLAG_NURSERY))
+			{
+				lval_del(v->base);
+			}
+			break;
+		}
+		for (int i = 0; i < v->count; ++i)
+		{
+			// Young children go with the nursery anyway
+			if (LVAL_IS_FIX(v->cell[i]) || !(v->cell[i]->flags & LFLAG_NURSERY))
+			{
+				lval_del(v->cell[i]);
+			}
+		}
+		lmem_free(LMEM_CELL, v->cell, sizeof(lval*) * v->cap);
+		break;
+	}
+}
+
+// Allocate from the nursery while evaluating a top-level form
+void lnursery_begin(void)
+{
+	if (lnursery.enabled && lcall_depth == 0)
+	{
+		lnursery.active = 1;
+	}
+}
+
+// Reset the nursery after a top-level form has been evaluated
+void lnursery_end(void)
+{
+	if (!lnursery.active || lcall_depth != 0)
+	{
+		return;
+	}
+	lnursery.active = 0;
+
+	for (struct lchunk* c = lnursery.first; c; c = c->next)
+	{
+		// Anything leaked still has to release what it owns
+		if (lnursery.live > 0)
+		{
+			char* p = LCHUNK_DATA(c);
+			while (p < c->top)
+			{
+				lval* v = (lval*)p;
+				if (!(v->flags & LFLAG_DEAD))
+				{
+					lnursery_finalize(v);
+				}
+				p += LSLAB_ROUND(lval_size(v->type));
+			}
+		}
+		c->top = LCHUNK_DATA(c);
+
+		if (c == lnursery.cur)
+		{
+			break;
+		}
+	}
+
+	lnursery.cur = lnursery.first;
+	lnursery.live = 0;
+	lnursery.resets++;
+}
+
+
+// add add two lval* increment the count realloc the cell, point the cell
+lval* lval_add(lval* v, lval* x)
+{
+	v = lval_own(v);
+
+	// Grow the cell geometrically
+	if (v->count == v->cap)
+	{
+		int cap = v->cap ? v->cap * 2 : 4;
+		v->cell = lmem_realloc(LMEM_CELL, v->cell, sizeof(lval*) * v->cap, sizeof(lval*) * cap);
+		v->cap = cap;
+	}
+
+	v->count++;
+	v->cell[v->count - 1] = x;
+	return v;
+}
+
+
+// lval* pops out the value at index i, v must be uniquely referenced
+lval* lval_pop(lval* v, int i)
+{
+	// Find the element at i
+	lval* x = v->cell[i];
+
+	// Shift memory after the element at i over the top
+	memmove(&v->cell[i],
+		&v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+
+	// Decrease the count of the items in the list, the capacity is kept
+	v->count--;
+	return x;
+}
+
+// deletes(takes) the element and deletes the rest of the list
+lval* lval_take(lval* v, int i)
+{
+	// A shared list or view is left intact and the element shared instead
+	if (v->refs > 1 || LVAL_IS_VIEW(v))
+	{
+		lval* x = lval_copy(v->cell[i]);
+		lval_del(v);
+		return x;
+	}
+
+	lval* x = lval_pop(v, i);
+	lval_del(v);
+	return x;
+}
+
+// Whether 'v' has an operator named 'k' not yet pointed at 'slot'
+int lval_resolves(lval* v, char* k, int slot)
+{
+	for (int i = 0; i < v->count; ++i)
+	{
+		lval* c = v->cell[i];
+		switch (LVAL_TYPE(c))
+		{
+		case LVAL_OPR:
+			if (c->opr == k && c->slot != slot)
+			{
+				return 1;
+			}
+			break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			if (lval_resolves(c, k, slot))
+			{
+				return 1;
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+// Point every operator in 'v' named 'k' at the slot it is bound in. The
+// body may share its lists and operators with other code, so whatever is
+// changed is owned first, and the result replaces 'v'.
+lval* lval_resolve(lval* v, char* k, int slot)
+{
+	if (!lval_resolves(v, k, slot))
+	{
+		return v;
+	}
+
+	v = lval_own(v);
+	for (int i = 0; i < v->count; ++i)
+	{
+		lval* c = v->cell[i];
+		switch (LVAL_TYPE(c))
+		{
+		case LVAL_OPR:
+			if (c->opr == k && c->slot != slot)
+			{
+				c = lval_own(c);
+				c->slot = slot;
+				v->cell[i] = c;
+			}
+			break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			v->cell[i] = lval_resolve(c, k, slot);
+			break;
+		}
+	}
+	return v;
+}
+
+// A constructor for user defined lval functions
+lval* lval_lambda(lval* formals, lval* body)
+{
+	lval* v = lval_alloc(LVAL_FUN);
+
+	v->builtin = NULL;
+	v->call = NULL;
+	v->env = lenv_new();
+
+	v->formals = formals;
+	v->body = body;
+	v->code = NULL;
+
+	// Formals are bound in order into the empty environment, so the body
+	// can be told the slot of each. Inner lambdas resolve the operators
+	// they bind again when they are made. Scope is dynamic so this is
+	// only a hint, lenv_get checks the slot still holds the operator.
+	v->arity = formals->count;
+	int slot = 0;
+	for (int i = 0; i < formals->count; ++i)
+	{
+		char* k = formals->cell[i]->opr;
+		if (k == lsym_amp)
+		{
+			v->arity = -1;
+			continue;
+		}
+
+		// A repeated formal rebinds the first one's slot
+		int j = 0;
+		while (formals->cell[j]->opr != k)
+		{
+			j++;
+		}
+		if (j < i)
+		{
+			v->arity = -1;
+			continue;
+		}
+		v->body = lval_resolve(v->body, k, slot++);
+	}
+	return v;
+}
+
+// Add a builtin for our lambda function
+lval* builtin_lambda(lenv* e, lval* a)
+{
+	// Check parameters to make sure only Q-Expressions
+	LASSERT_NUM("\\", a, 2);
+	LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
+	LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+
+	// Check first Q-Expression contains only operators
+	for (int i = 0; i < a->cell[0]->count; ++i)
+	{
+		LASSERT(a, (LVAL_TYPE(a->cell[0]->cell[i]) == LVAL_OPR),
+			"Cannot define non-operator! Got %s, Expected %s.", 
+			ltype_name(LVAL_TYPE(a->cell[0]->cell[i])), ltype_name(LVAL_OPR));
+	}
+
+	// Pop the first two arguments and pass them to lval_lambda
+	lval* formals = lval_pop(a, 0);
+	lval* body = lval_pop(a, 0);
+	lval_del(a);
+
+	return lval_lambda(formals, body);
+}
+
+// Print out the Sub expressions line by line
+void lval_expr_print(lval* v, char open, char close)
+{
+	putchar(open);
+	for (int i = 0; i < v->count; ++i)
+	{
+
+		// Print value contained within
+		lval_print(v->cell[i]);
+
+		// Avoid printing trailing space if last element
+		if (i != (v->count - 1))
+		{
+			putchar(' ');
+		}
+	}
+
+	putchar(close);
+}
+
+// Print a string unescaped
+void lval_print_str(lval* v)
+{
+	// Make a copy of the string
+	char* escaped = malloc(strlen(v->str) + 1);
+	strcpy_s(escaped, (strlen(v->str) + 1), v->str);
+	
+	// Pass it through the escape function
+	escaped = mpcf_escape(escaped);
+
+	// Print it between ""
+	printf("\"%s\"", escaped);
+	
+	// Free the copied string
+	free(escaped);
+}
+
+// Print a bignum, nine decimal digits are divided off at a time
+void lval_big_print(lval* v)
+{
+	int n = v->nlimbs;
+	uint32_t* m = malloc(sizeof(uint32_t) * n);
+	memcpy(m, v->limbs, sizeof(uint32_t) * n);
+	uint32_t* digits = malloc(sizeof(uint32_t) * (n * 32 / 29 + 1));
+	int k = 0;
+	while (n > 0)
+	{
+		digits[k++] = lmag_divsmall(m, n, 1000000000);
+		n = lmag_len(m, n);
+	}
+
+	printf("%s%u", v->neg ? "-" : "", (unsigned)digits[k - 1]);
+	for (int i = k - 2; i >= 0; --i)
+	{
+		printf("%09u", (unsigned)digits[i]);
+	}
+	free(m);
+	free(digits);
+}
+
+// Print a double so that it reads back the same, with a point or an
+// exponent to tell it from an integer
+void lval_dbl_print(lval* v)
+{
+	// The sign of NaN is left to the C library, don't show it
+	if (isnan(v->dbl))
+	{
+		printf("nan");
+		return;
+	}
+
+	// The fewest digits that give the same double
+	char buf[32];
+	for (int digits = 15; digits <= 17; ++digits)
+	{
+		snprintf(buf, sizeof(buf), "%.*g", digits, v->dbl);
+		if (strtod(buf, NULL) == v->dbl)
+		{
+			break;
+		}
+	}
+	if (isfinite(v->dbl) && !strpbrk(buf, ".e"))
+	{
+		strcat(buf, ".0");
+	}
+	printf("%s", buf);
+}
+
+// Print a vector as its numbers between []
+void lval_vec_print(lval* v)
+{
+	putchar('[');
+	for (long i = 0; i < v->len; ++i)
+	{
+		printf(i ? " %lld" : "%lld", (long long)v->data[i]);
+	}
+	putchar(']');
+}
+
+
+// Print an "lval"
+void lval_print(lval* v)
+{
+	switch (LVAL_TYPE(v))
+	{
+	case LVAL_FUN:
+		if (v->builtin)
+		{
+			printf("<builtin>");
+		}
+		else
+		{
+			printf("\\ ");
+			lval_print(v->formals);
+			putchar(' ');
+			lval_print(v->body);
+			putchar(')');
+		}
+		break;
+	case LVAL_NUM:
+		if (LVAL_IS_BIG(v))
+		{
+			lval_big_print(v);
+		}
+		else
+		{
+			printf("%li", LVAL_LONG(v));
+		}
+		break;
+	case LVAL_ERR:
+		printf("Error: %s", v->err);
+		break;
+	case LVAL_OPR:
+		printf("%s", v->opr);
+		break;
+	case LVAL_STR:
+		lval_print_str(v);
+		break;
+	case LVAL_SEXPR:
+		lval_expr_print(v, '(', ')');
+		break;
+	case LVAL_QEXPR:
+		lval_expr_print(v, '{', '}');
+		break;
+	case LVAL_VEC:
+		lval_vec_print(v);
+		break;
+	case LVAL_DBL:
+		lval_dbl_print(v);
+		break;
+	}
+}
+
+
+// Print an "lval" followed by a newline character.
+void lval_println(lval* v)
+{
+	lval_print(v);
+	putchar('\n');
+}
+
+// Check if two values for equality
+int lval_eq(lval* x, lval* y)
+{
+	// Numbers compare by value whatever their kind
+	if (LVAL_IS_NUMBER(x) && LVAL_IS_NUMBER(y))
+	{
+		return LNUM_ORD(x, y, ==);
+	}
+
+	// Different type are always equal
+	if (LVAL_TYPE(x) != LVAL_TYPE(y))
+	{
+		return 0;
+	}
+	
+	// Compare based upton type
+	switch (LVAL_TYPE(x))
+	{
+	
+	// Compare string values
+	case LVAL_ERR:
+		return (strcmp(x->err, y->err) == 0);
+	case LVAL_OPR:
+		return (x->opr == y->opr);
+	case LVAL_STR:
+		return (strcmp(x->str, y->str) == 0);
+	case LVAL_VEC:
+		return x->len == y->len && memcmp(x->data, y->data, sizeof(int64_t) * x->len) == 0;
+
+	// If builtin compare, otherwise compare formals and body
+	case LVAL_FUN:
+		if (x->builtin || y->builtin)
+		{
+			return x->builtin == y->builtin;
+		}
+		else
+		{
+			return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+		}
+
+	// If list compare every individual element
+	case LVAL_QEXPR:
+	case LVAL_SEXPR:
+		if (x->count != y->count)
+		{
+			return 0;
+		}
+		for (int i = 0; i < x->count; ++i)
+		{
+			// If any element not equal then whole list is not equal
+			if (!lval_eq(x->cell[i], y->cell[i]))
+			{
+				return 0;
+			}
+		}
+		
+		// Otherwise must be equal
+		return 1;
+		break;	
+	}
+
+	return 0;
+}
+
+// Returns the branch 'if' evaluates as an S-Expression, or an error
+lval* lval_if_expr(lval* a)
+{
+	LASSERT_NUM("if", a, 3);
+	LASSERT_TYPE("if", a, 0, LVAL_NUM);
+	LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
+	LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+
+	// Take the chosen Expression
+	lval* x;
+	if (LVAL_LONG(a->cell[0]))
+	{
+		// If condition is true evaluate first expression
+		x = lval_take(a, 1);
+	}
+	else
+	{
+		// Otherwise evaluate second expression
+		x = lval_take(a, 2);
+	}
+
+	// Mark it evaluable
+	x = lval_own(x);
+	x->type = LVAL_SEXPR;
+	return x;
+}
+
+// Generate a builtin for if
+lval* builtin_if(lenv* e, lval* a)
+{
+	return lval_eval(e, lval_if_expr(a));
+}
+
+
+// Sum a run of numbers into 'r', false if one isn't a long or the sum
+// overflows. Fixnums are summed as their high and low 32 bits separately,
+// which can't overflow and needs no branches, so the loop vectorises.
+int lnum_sum(lval** xs, int n, long* r)
+{
+	uintptr_t tags = 1;
+	for (int i = 0; i < n; ++i)
+	{
+		tags &= (uintptr_t)xs[i];
+	}
+
+	if (tags)
+	{
+		int64_t hi = 0;
+		uint64_t lo = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			int64_t x = (int64_t)((intptr_t)xs[i] >> 1);
+			hi += x >> 32;
+			lo += (uint32_t)x;
+		}
+
+		if (hi > (INT64_MAX >> 32) || hi < (INT64_MIN >> 32))
+		{
+			return 0;
+		}
+		int64_t x = hi * ((int64_t)1 << 32);
+		if (x > INT64_MAX - (int64_t)lo)
+		{
+			return 0;
+		}
+		x += (int64_t)lo;
+		if (x < LONG_MIN || x > LONG_MAX)
+		{
+			return 0;
+		}
+		*r = (long)x;
+		return 1;
+	}
+
+	long x = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		if (!LVAL_IS_LONG(xs[i]) || lnum_add_ovf(x, LVAL_LONG(xs[i]), &x))
+		{
+			return 0;
+		}
+	}
+	*r = x;
+	return 1;
+}
+
+// Fold +, -, *, / or % over numbers as doubles, once any of them is one
+lval* ldbl_fold(int argc, lval** argv, char op)
+{
+	double x = ldbl_of(argv[0]);
+	if (op == '-' && argc == 1)
+	{
+		x = -x;
+	}
+
+	for (int i = 1; i < argc; ++i)
+	{
+		double y = ldbl_of(argv[i]);
+		if ((op == '/' || op == '%') && y == 0)
+		{
+			return lval_err("Division By Zero!");
+		}
+
+		switch (op)
+		{
+		case '+': x += y; break;
+		case '-': x -= y; break;
+		case '*': x *= y; break;
+		case '/': x /= y; break;
+		case '%': x = fmod(x, y); break;
+		default: x = pow(x, y); break;
+		}
+	}
+
+	return lval_dbl(x);
+}
+
+// Whether any argument is a double
+int ldbl_any(int argc, lval** argv)
+{
+	for (int i = 0; i < argc; ++i)
+	{
+		if (LVAL_TYPE(argv[i]) == LVAL_DBL)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Fold +, -, *, / or % over numbers of any size or kind, used once an
+// argument isn't a long or a result doesn't fit in one
+lval* lnum_fold(int argc, lval** argv, char op)
+{
+	if (ldbl_any(argc, argv))
+	{
+		return ldbl_fold(argc, argv, op);
+	}
+
+	uint32_t buf[2];
+	lbig x = lbig_copy(lbig_of(argv[0], buf));
+	if (op == '-' && argc == 1)
+	{
+		x.neg = !x.neg;
+	}
+
+	for (int i = 1; i < argc; ++i)
+	{
+		lbig y = lbig_of(argv[i], buf);
+		lbig r;
+		if ((op == '/' || op == '%') && y.n == 0)
+		{
+			free(x.d);
+			return lval_err("Division By Zero!");
+		}
+
+		switch (op)
+		{
+		case '+':
+			r = lbig_add(x, y);
+			break;
+		case '-':
+			y.neg = !y.neg;
+			r = lbig_add(x, y);
+			break;
+		case '*':
+			r = lbig_mul(x, y);
+			break;
+		default:
+			r = lbig_div(x, y, op == '%');
+			break;
+		}
+		free(x.d);
+		x = r;
+	}
+
+	return lval_big(x);
+}
+
+// x to the power of y by repeated squaring, x is consumed
+lval* lnum_pow(lval* x, lval* y)
+{
+	uint32_t buf[2];
+	lbig b = lbig_of(x, buf);
+
+	// Negative powers truncate to 0 apart from those of 1 and -1, and huge
+	// ones can only be taken of 0, 1 and -1
+	if (LVAL_IS_BIG(y) || LVAL_LONG(y) < 0)
+	{
+		int neg = LVAL_IS_BIG(y) ? y->neg : 1;
+		int odd = (LVAL_IS_BIG(y) ? y->limbs[0] : (uint32_t)LVAL_LONG(y)) & 1;
+		lval* r;
+		if (b.n == 1 && b.d[0] == 1)
+		{
+			r = lval_num(b.neg && odd ? -1 : 1);
+		}
+		else if (b.n == 0 && neg)
+		{
+			r = lval_err("Division By Zero!");
+		}
+		else if (b.n == 0 || neg)
+		{
+			r = lval_num(0);
+		}
+		else
+		{
+			r = lval_err("Function '%s' passed an exponent too large.", "^");
+		}
+		lval_del(x);
+		return r;
+	}
+	long n = LVAL_LONG(y);
+
+	// Stay in a long while the result fits
+	if (!LVAL_IS_BIG(x))
+	{
+		long p = LVAL_LONG(x);
+		long r = 1;
+		int ovf = 0;
+		for (long k = n; k && !ovf; k >>= 1)
+		{
+			if (k & 1)
+			{
+				ovf = lnum_mul_ovf(r, p, &r);
+			}
+			if (k > 1 && !ovf)
+			{
+				ovf = lnum_mul_ovf(p, p, &p);
+			}
+		}
+		if (!ovf)
+		{
+			lval_del(x);
+			return lval_num(r);
+		}
+	}
+
+	lbig r;
+	r.neg = 0;
+	r.n = 1;
+	r.d = malloc(sizeof(uint32_t));
+	r.d[0] = 1;
+	b = lbig_copy(b);
+	for (long k = n; k; k >>= 1)
+	{
+		lbig t;
+		if (k & 1)
+		{
+			t = lbig_mul(r, b);
+			free(r.d);
+			r = t;
+		}
+		if (k > 1)
+		{
+			t = lbig_mul(b, b);
+			free(b.d);
+			b = t;
+		}
+	}
+	free(b.d);
+	lval_del(x);
+	return lval_big(r);
+}
+
+// Call a builtin taking an argument vector with an argument list
+lval* lval_argv(lenv* e, lval* a, lbuiltinv func)
+{
+	lval* r = func(e, a->count, a->cell);
+	lval_del(a);
+	return r;
+}
+
+// builtin mathematical functions, each reducing over its arguments in one
+// pass on longs and falling back to bignums
+lval* builtinv_add(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUMS("+", argc, argv);
+	long x;
+	if (!lnum_sum(argv, argc, &x))
+	{
+		return lnum_fold(argc, argv, '+');
+	}
+	return lval_num(x);
+}
+
+lval* builtinv_sub(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_SOME("-", argc);
+	LASSERTV_NUMS("-", argc, argv);
+
+	// If no arguments and subtract then perform unary negation
+	long x = LVAL_LONG(argv[0]);
+	long y = 0;
+	int ok = LVAL_IS_LONG(argv[0]);
+	if (argc == 1)
+	{
+		ok = ok && !lnum_sub_ovf(y, x, &x);
+	}
+	else
+	{
+		ok = ok && lnum_sum(argv + 1, argc - 1, &y) && !lnum_sub_ovf(x, y, &x);
+	}
+
+	if (!ok)
+	{
+		return lnum_fold(argc, argv, '-');
+	}
+	return lval_num(x);
+}
+
+lval* builtinv_mul(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUMS("*", argc, argv);
+	long x = 1;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!LVAL_IS_LONG(argv[i]) || lnum_mul_ovf(x, LVAL_LONG(argv[i]), &x))
+		{
+			return lnum_fold(argc, argv, '*');
+		}
+	}
+	return lval_num(x);
+}
+
+lval* builtinv_div(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_SOME("/", argc);
+	LASSERTV_NUMS("/", argc, argv);
+	long x = LVAL_LONG(argv[0]);
+	int big = !LVAL_IS_LONG(argv[0]);
+	for (int i = 1; i < argc && !big; ++i)
+	{
+		long y = LVAL_LONG(argv[i]);
+		big = !LVAL_IS_LONG(argv[i]);
+		LASSERTV(big || y != 0, "Division By Zero!");
+
+		// The only quotient of longs that overflows
+		big = big || (x == LONG_MIN && y == -1);
+		x = big ? x : x / y;
+	}
+
+	if (big)
+	{
+		return lnum_fold(argc, argv, '/');
+	}
+	return lval_num(x);
+}
+
+lval* builtinv_mod(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_SOME("%", argc);
+	LASSERTV_NUMS("%", argc, argv);
+	long x = LVAL_LONG(argv[0]);
+	int big = !LVAL_IS_LONG(argv[0]);
+	for (int i = 1; i < argc && !big; ++i)
+	{
+		long y = LVAL_LONG(argv[i]);
+		big = !LVAL_IS_LONG(argv[i]);
+		LASSERTV(big || y != 0, "Division By Zero!");
+		big = big || (x == LONG_MIN && y == -1);
+		x = big ? x : x % y;
+	}
+
+	if (big)
+	{
+		return lnum_fold(argc, argv, '%');
+	}
+	return lval_num(x);
+}
+
+lval* builtinv_pow(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_SOME("^", argc);
+	LASSERTV_NUMS("^", argc, argv);
+	if (ldbl_any(argc, argv))
+	{
+		return ldbl_fold(argc, argv, '^');
+	}
+
+	lval* x = lval_copy(argv[0]);
+	for (int i = 1; i < argc && LVAL_TYPE(x) == LVAL_NUM; ++i)
+	{
+		x = lnum_pow(x, argv[i]);
+	}
+	return x;
+}
+
+lval* builtinv_min(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_SOME("min", argc);
+	LASSERTV_NUMS("min", argc, argv);
+	lval* x = argv[0];
+	for (int i = 1; i < argc; ++i)
+	{
+		x = LNUM_ORD(argv[i], x, <) ? argv[i] : x;
+	}
+	return lval_copy(x);
+}
+
+lval* builtinv_max(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_SOME("max", argc);
+	LASSERTV_NUMS("max", argc, argv);
+	lval* x = argv[0];
+	for (int i = 1; i < argc; ++i)
+	{
+		x = LNUM_ORD(argv[i], x, >) ? argv[i] : x;
+	}
+	return lval_copy(x);
+}
+
+lval* builtin_add(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_add);
+}
+
+lval* builtin_sub(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_sub);
+}
+
+lval* builtin_mul(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_mul);
+}
+
+lval* builtin_div(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_div);
+}
+
+lval* builtin_mod(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_mod);
+}
+
+lval* builtin_pow(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_pow);
+}
+
+lval* builtin_min(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_min);
+}
+
+lval* builtin_max(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_max);
+}
+
+// Functions of one number computed on doubles, integers are converted first
+lval* ldbl_unary(lval* a, char* func, double (*f)(double))
+{
+	LASSERT_NUM(func, a, 1);
+	LASSERT_NUMS(func, a);
+	double x = f(ldbl_of(a->cell[0]));
+	lval_del(a);
+	return lval_dbl(x);
+}
+
+lval* builtin_sqrt(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "sqrt", sqrt);
+}
+
+lval* builtin_exp(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "exp", exp);
+}
+
+lval* builtin_log(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "log", log);
+}
+
+lval* builtin_sin(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "sin", sin);
+}
+
+lval* builtin_cos(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "cos", cos);
+}
+
+lval* builtin_tan(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "tan", tan);
+}
+
+lval* builtin_atan(lenv* e, lval* a)
+{
+	return ldbl_unary(a, "atan", atan);
+}
+
+// Convert a number to a double
+lval* builtin_float(lenv* e, lval* a)
+{
+	LASSERT_NUM("float", a, 1);
+	LASSERT_NUMS("float", a);
+	double x = ldbl_of(a->cell[0]);
+	lval_del(a);
+	return lval_dbl(x);
+}
+
+// Round a number to an integer, integers are already whole
+lval* ldbl_round(lval* a, char* func, double (*f)(double))
+{
+	LASSERT_NUM(func, a, 1);
+	LASSERT_NUMS(func, a);
+	if (LVAL_TYPE(a->cell[0]) == LVAL_NUM)
+	{
+		return lval_take(a, 0);
+	}
+
+	double x = f(a->cell[0]->dbl);
+	LASSERT(a, isfinite(x), "Function '%s' passed %s, which has no integer value.",
+		func, isnan(x) ? "NaN" : "an infinity");
+	lval_del(a);
+	return lval_dbl_int(x);
+}
+
+lval* builtin_floor(lenv* e, lval* a)
+{
+	return ldbl_round(a, "floor", floor);
+}
+
+lval* builtin_ceil(lenv* e, lval* a)
+{
+	return ldbl_round(a, "ceil", ceil);
+}
+
+lval* builtin_round(lenv* e, lval* a)
+{
+	return ldbl_round(a, "round", round);
+}
+
+lval* builtin_trunc(lenv* e, lval* a)
+{
+	return ldbl_round(a, "trunc", trunc);
+}
+
+lval* builtin_def(lenv* e, lval* a)
+{
+	return builtin_var(e, a, "def");
+}
+
+lval* builtin_put(lenv* e, lval* a)
+{
+	return builtin_var(e, a, "=");
+}
+
+// Orders like >, <, >= and <=
+lval* builtinv_gt(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM(">", argc, 2);
+	LASSERTV_NUMS(">", argc, argv);
+	return lval_num(LNUM_ORD(argv[0], argv[1], >));
+}
+
+lval* builtinv_lt(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("<", argc, 2);
+	LASSERTV_NUMS("<", argc, argv);
+	return lval_num(LNUM_ORD(argv[0], argv[1], <));
+}
+
+lval* builtinv_ge(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM(">=", argc, 2);
+	LASSERTV_NUMS(">=", argc, argv);
+	return lval_num(LNUM_ORD(argv[0], argv[1], >=));
+}
+
+lval* builtinv_le(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("<=", argc, 2);
+	LASSERTV_NUMS("<=", argc, argv);
+	return lval_num(LNUM_ORD(argv[0], argv[1], <=));
+}
+
+// Comparisons like == and !=
+lval* builtinv_eq(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("==", argc, 2);
+	return lval_num(lval_eq(argv[0], argv[1]));
+}
+
+lval* builtinv_ne(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("!=", argc, 2);
+	return lval_num(!lval_eq(argv[0], argv[1]));
+}
+
+// Whether a number counts as true. Doubles go by value, so -0.0 is false,
+// and bignums by their sign and magnitude as their 'num' is clamped.
+int lnum_true(lval* v)
+{
+	if (LVAL_TYPE(v) == LVAL_DBL)
+	{
+		return v->dbl != 0;
+	}
+	if (LVAL_IS_BIG(v))
+	{
+		return v->neg || v->nlimbs != 0;
+	}
+	return LVAL_LONG(v) != 0;
+}
+
+// Logical operators like and, or and not!
+lval* builtinv_and(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("and", argc, 2);
+	LASSERTV_NUMS("and", argc, argv);
+	return lval_num(lnum_true(argv[0]) && lnum_true(argv[1]));
+}
+
+lval* builtinv_or(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("or", argc, 2);
+	LASSERTV_NUMS("or", argc, argv);
+	return lval_num(lnum_true(argv[0]) || lnum_true(argv[1]));
+}
+
+lval* builtinv_not(lenv* e, int argc, lval** argv)
+{
+	LASSERTV_NUM("not", argc, 1);
+	LASSERTV_NUMS("not", argc, argv);
+	return lval_num(!lnum_true(argv[0]));
+}
+
+lval* builtin_gt(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_gt);
+}
+
+lval* builtin_lt(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_lt);
+}
+
+lval* builtin_ge(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_ge);
+}
+
+lval* builtin_le(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_le);
+}
+
+lval* builtin_eq(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_eq);
+}
+
+lval* builtin_ne(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_ne);
+}
+
+lval* builtin_and(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_and);
+}
+
+lval* builtin_or(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_or);
+}
+
+lval* builtin_not(lenv* e, lval* a)
+{
+	return lval_argv(e, a, builtinv_not);
+}
+
+
+// Return a string of the type expected
+char* ltype_name(int t)
+{
+	switch (t)
+	{
+	case LVAL_FUN:
+		return "Function";
+	case LVAL_NUM:
+		return "Number";
+	case LVAL_ERR:
+		return "Error";
+	case LVAL_OPR:
+		return "Operator";
+	case LVAL_STR:
+		return "String";
+	case LVAL_SEXPR:
+		return "S-Expression";
+	case LVAL_QEXPR:
+		return "Q-Expression";
+	case LVAL_VEC:
+		return "Vector";
+	case LVAL_DBL:
+		return "Float";
+	default:
+		return "Unknown";
+	}
+}
+
+// return an lval* of head from an Qexpr
+lval* builtin_head(lenv* e, lval* a)
+{
+	// Check possible error conditions
+	LASSERT_NUM("head", a, 1);
+
+	LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
+
+	LASSERT_NOT_EMPTY("head", a, 0);
+
+	// Otherwise view the first element of the first argument
+	return lval_slice(lval_take(a, 0), 0, 1);
+}
+
+// return an lval* of head from an Qexpr
+lval* builtin_tail(lenv* e, lval* a)
+{
+	// Check possible error conditions
+	LASSERT_NUM("tail", a, 1);
+
+	LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
+
+	LASSERT_NOT_EMPTY("tail", a, 0);
+
+	// Otherwise view all but the first element
+	lval* v = lval_take(a, 0);
+	return lval_slice(v, 1, v->count - 1);
+}
+
+// List functions
+// These used to be written in Lispi in the standard prelude and behave
+// the same: the same errors are returned (mostly those of the 'head',
+// 'tail' and '-' calls the prelude versions made), elements are evaluated
+// where the prelude used 'fst' on them, and they can be partially applied.
+
+// Check the arguments of a list function. With fewer than 'argc' it
+// returns a function taking the rest, like a partially applied lambda
+// would, formals are named by the letters of 'names'. Returns NULL if
+// the arguments are complete.
+lval* llist_args(lval* a, lbuiltin func, int argc, char* names)
+{
+	if (a->count > argc)
+	{
+		int given = a->count;
+		lval_del(a);
+		return lval_err("Function passed too many arguments! Got %d, Expected %d.", given, argc);
+	}
+	if (a->count == argc)
+	{
+		return NULL;
+	}
+
+	// Body calls the builtin with the arguments given so far
+	lval* formals = lval_qexpr();
+	lval* body = lval_add(lval_qexpr(), lval_builtin(func));
+	for (int i = 0; i < a->count; ++i)
+	{
+		body = lval_add(body, lval_copy(a->cell[i]));
+	}
+	for (int i = a->count; i < argc; ++i)
+	{
+		char name[2] = { names[i], '\0' };
+		formals = lval_add(formals, lval_opr(name));
+		body = lval_add(body, lval_opr(name));
+	}
+
+	lval_del(a);
+	return lval_lambda(formals, body);
+}
+
+// Error 'head' or 'tail' gives for a list, NULL if it is a non-empty Q-Expression
+lval* llist_err(char* func, lval* l)
+{
+	if (LVAL_TYPE(l) != LVAL_QEXPR)
+	{
+		return lval_err("Function '%s' passed incorrect type for argument %d. Got %s, Expected %s.",
+			func, 0, ltype_name(LVAL_TYPE(l)), ltype_name(LVAL_QEXPR));
+	}
+	if (l->count == 0)
+	{
+		return lval_err("Function '%s' passed {} for argument %d.", func, 0);
+	}
+	return NULL;
+}
+
+// Error a list builtin gives when counting with anything but an integer
+lval* llist_count_err(char* func, lval* n)
+{
+	return lval_err("Function '%s' passed incorrect type for argument %d. Got %s, Expected Integer.",
+		func, 0, ltype_name(LVAL_TYPE(n)));
+}
+
+// Whether a value is the empty list 'nil'
+int llist_nil(lval* l)
+{
+	return LVAL_TYPE(l) == LVAL_QEXPR && l->count == 0;
+}
+
+// Evaluate an element as 'fst' would
+lval* llist_fst(lenv* e, lval* l, int i)
+{
+	return lval_eval(e, lval_copy(l->cell[i]));
+}
+
+// Apply a function to one or two evaluated arguments
+lval* llist_call(lenv* e, lval* f, lval* x, lval* y)
+{
+	lval* v = lval_add(lval_add(lval_sexpr(), lval_copy(f)), x);
+	if (y)
+	{
+		v = lval_add(v, y);
+	}
+	return lval_invoke(e, v);
+}
+
+// Returns the first N items of a Q-Expression
+lval* builtin_take(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_take, 2, "nl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* n = a->cell[0];
+	lval* l = a->cell[1];
+	if (llist_nil(l) || (LVAL_TYPE(n) == LVAL_NUM && LVAL_LONG(n) == 0))
+	{
+		r = LVAL_TYPE(n) == LVAL_NUM && LVAL_LONG(n) == 0 ? lval_qexpr() : llist_err("head", l);
+		lval_del(a);
+		return r;
+	}
+	if ((r = llist_err("head", l)) || (LVAL_TYPE(n) != LVAL_NUM && (r = llist_count_err("take", n))))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	// Counting past the end runs into an empty list
+	long k = LVAL_LONG(n);
+	if (k < 0 || k > l->count)
+	{
+		lval_del(a);
+		return lval_err("Function '%s' passed {} for argument %d.", "head", 0);
+	}
+	return lval_slice(lval_take(a, 1), 0, (int)k);
+}
+
+// Returns all but the first N items of a Q-Expression
+lval* builtin_drop(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_drop, 2, "nl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* n = a->cell[0];
+	if (LVAL_TYPE(n) == LVAL_NUM && LVAL_LONG(n) == 0)
+	{
+		return lval_take(a, 1);
+	}
+	if ((LVAL_TYPE(n) != LVAL_NUM && (r = llist_count_err("drop", n))) || (r = llist_err("tail", a->cell[1])))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	lval* l = a->cell[1];
+	long k = LVAL_LONG(n);
+	if (k < 0 || k > l->count)
+	{
+		lval_del(a);
+		return lval_err("Function '%s' passed {} for argument %d.", "tail", 0);
+	}
+	l = lval_take(a, 1);
+	return lval_slice(l, (int)k, l->count - (int)k);
+}
+
+// Number of items in a list
+lval* builtin_len(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_len, 1, "l");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* l = a->cell[0];
+	r = llist_nil(l) ? lval_num(0) : llist_err("tail", l);
+	if (!r)
+	{
+		r = lval_num(l->count);
+	}
+	lval_del(a);
+	return r;
+}
+
+// Nth item in a list, evaluated
+lval* builtin_nth(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_nth, 2, "nl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* n = a->cell[0];
+	lval* l = a->cell[1];
+	if (LVAL_TYPE(n) != LVAL_NUM)
+	{
+		r = llist_count_err("nth", n);
+	}
+	else if (LVAL_LONG(n) == 0)
+	{
+		r = llist_err("head", l);
+	}
+	else if (!(r = llist_err("tail", l)))
+	{
+		// Counting past the end runs into an empty list
+		long k = LVAL_LONG(n);
+		if (k < 0 || k > l->count)
+		{
+			r = lval_err("Function '%s' passed {} for argument %d.", "tail", 0);
+		}
+		else if (k == l->count)
+		{
+			r = lval_err("Function '%s' passed {} for argument %d.", "head", 0);
+		}
+		else
+		{
+			r = llist_fst(e, l, (int)k);
+		}
+	}
+
+	if (!r)
+	{
+		r = llist_fst(e, l, 0);
+	}
+	lval_del(a);
+	return r;
+}
+
+// Last item in a list, evaluated
+lval* builtin_last(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_last, 1, "l");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* l = a->cell[0];
+	if (llist_nil(l))
+	{
+		r = lval_err("Function '%s' passed {} for argument %d.", "tail", 0);
+	}
+	else if (!(r = llist_err("tail", l)))
+	{
+		r = llist_fst(e, l, l->count - 1);
+	}
+	lval_del(a);
+	return r;
+}
+
+// Apply a function to every item in a list
+lval* builtin_map(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_map, 2, "fl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* f = a->cell[0];
+	lval* l = a->cell[1];
+	if (llist_nil(l) || (r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r ? r : lval_qexpr();
+	}
+
+	// Every item is mapped even after an error, the first error is returned
+	lval* err = NULL;
+	r = lval_qexpr();
+	for (int i = 0; i < l->count; ++i)
+	{
+		lval* x = llist_fst(e, l, i);
+		if (LVAL_TYPE(x) != LVAL_ERR)
+		{
+			x = llist_call(e, f, x, NULL);
+		}
+
+		if (LVAL_TYPE(x) == LVAL_ERR && !err)
+		{
+			err = x;
+		}
+		else if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			lval_del(x);
+		}
+		else
+		{
+			r = lval_add(r, x);
+		}
+	}
+
+	lval_del(a);
+	if (err)
+	{
+		lval_del(r);
+		return err;
+	}
+	return r;
+}
+
+// Items of a list for which a function is true
+lval* builtin_filter(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_filter, 2, "fl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* f = a->cell[0];
+	lval* l = a->cell[1];
+	if (llist_nil(l) || (r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r ? r : lval_qexpr();
+	}
+
+	// Every item is tested even after an error, the first error is returned
+	lval* err = NULL;
+	r = lval_qexpr();
+	for (int i = 0; i < l->count; ++i)
+	{
+		lval* x = llist_fst(e, l, i);
+		if (LVAL_TYPE(x) != LVAL_ERR)
+		{
+			x = llist_call(e, f, x, NULL);
+		}
+		if (LVAL_TYPE(x) != LVAL_ERR && LVAL_TYPE(x) != LVAL_NUM)
+		{
+			lval* y = lval_err("Function '%s' passed incorrect type for argument %d. Got %s, Expected %s.",
+				"if", 0, ltype_name(LVAL_TYPE(x)), ltype_name(LVAL_NUM));
+			lval_del(x);
+			x = y;
+		}
+
+		if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			if (!err)
+			{
+				err = x;
+				continue;
+			}
+		}
+		else if (LVAL_LONG(x))
+		{
+			r = lval_add(r, lval_copy(l->cell[i]));
+		}
+		lval_del(x);
+	}
+
+	lval_del(a);
+	if (err)
+	{
+		lval_del(r);
+		return err;
+	}
+	return r;
+}
+
+// Reverse a list
+lval* builtin_reverse(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_reverse, 1, "l");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* l = a->cell[0];
+	if (llist_nil(l) || (r = llist_err("tail", l)))
+	{
+		lval_del(a);
+		return r ? r : lval_qexpr();
+	}
+
+	r = lval_qexpr();
+	for (int i = l->count - 1; i >= 0; --i)
+	{
+		r = lval_add(r, lval_copy(l->cell[i]));
+	}
+	lval_del(a);
+	return r;
+}
+
+// Fold a function over a list from the left
+lval* builtin_foldl(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_foldl, 3, "fzl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* f = a->cell[0];
+	lval* l = a->cell[2];
+	if (!llist_nil(l) && (r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	// Stops at the first error
+	r = lval_copy(a->cell[1]);
+	for (int i = 0; i < l->count && LVAL_TYPE(r) != LVAL_ERR; ++i)
+	{
+		lval* x = llist_fst(e, l, i);
+		if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			lval_del(r);
+			r = x;
+		}
+		else
+		{
+			r = llist_call(e, f, r, x);
+		}
+	}
+	lval_del(a);
+	return r;
+}
+
+// Fold a function over a list from the right
+lval* builtin_foldr(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_foldr, 3, "fzl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* f = a->cell[0];
+	lval* l = a->cell[2];
+	if (!llist_nil(l) && (r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	// Items are all evaluated before the function is applied from the right,
+	// an error in an item wins over one from the items after it
+	lval** xs = malloc(sizeof(lval*) * l->count);
+	for (int i = 0; i < l->count; ++i)
+	{
+		xs[i] = llist_fst(e, l, i);
+	}
+
+	r = lval_copy(a->cell[1]);
+	for (int i = l->count - 1; i >= 0; --i)
+	{
+		if (LVAL_TYPE(xs[i]) == LVAL_ERR)
+		{
+			lval_del(r);
+			r = xs[i];
+		}
+		else if (LVAL_TYPE(r) == LVAL_ERR)
+		{
+			lval_del(xs[i]);
+		}
+		else
+		{
+			r = llist_call(e, f, xs[i], r);
+		}
+	}
+	free(xs);
+	lval_del(a);
+	return r;
+}
+
+// Whether an item is in a list
+lval* builtin_elem(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_elem, 2, "xl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* l = a->cell[1];
+	if (!llist_nil(l) && (r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	for (int i = 0; i < l->count && !r; ++i)
+	{
+		lval* y = llist_fst(e, l, i);
+		if (LVAL_TYPE(y) == LVAL_ERR)
+		{
+			r = y;
+		}
+		else
+		{
+			if (lval_eq(a->cell[0], y))
+			{
+				r = lval_num(1);
+			}
+			lval_del(y);
+		}
+	}
+
+	lval_del(a);
+	return r ? r : lval_num(0);
+}
+
+// Find an item in a list of pairs
+lval* builtin_lookup(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_lookup, 2, "xl");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* l = a->cell[1];
+	if (!llist_nil(l) && (r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	for (int i = 0; i < l->count && !r; ++i)
+	{
+		lval* p = llist_fst(e, l, i);
+		lval* key = LVAL_TYPE(p) == LVAL_ERR ? lval_copy(p) : llist_err("head", p);
+		if (!key)
+		{
+			key = llist_fst(e, p, 0);
+		}
+		if (LVAL_TYPE(key) == LVAL_ERR)
+		{
+			r = key;
+			lval_del(p);
+			break;
+		}
+
+		// The value of every pair looked at is evaluated too
+		lval* val = p->count > 1 ? llist_fst(e, p, 1)
+			: lval_err("Function '%s' passed {} for argument %d.", "head", 0);
+		if (LVAL_TYPE(val) == LVAL_ERR || lval_eq(key, a->cell[0]))
+		{
+			r = val;
+		}
+		else
+		{
+			lval_del(val);
+		}
+		lval_del(key);
+		lval_del(p);
+	}
+
+	lval_del(a);
+	return r ? r : lval_err("No Element Found");
+}
+
+// Zip two lists together into a list of pairs
+lval* builtin_zip(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_zip, 2, "xy");
+	if (r)
+	{
+		return r;
+	}
+
+	lval* x = a->cell[0];
+	lval* y = a->cell[1];
+	if (llist_nil(x) || llist_nil(y) || (r = llist_err("head", x)) || (r = llist_err("head", y)))
+	{
+		lval_del(a);
+		return r ? r : lval_qexpr();
+	}
+
+	r = lval_qexpr();
+	for (int i = 0; i < x->count && i < y->count; ++i)
+	{
+		lval* p = lval_add(lval_qexpr(), lval_copy(x->cell[i]));
+		r = lval_add(r, lval_add(p, lval_copy(y->cell[i])));
+	}
+	lval_del(a);
+	return r;
+}
+
+// Unzip a list of pairs into two lists
+lval* builtin_unzip(lenv* e, lval* a)
+{
+	lval* r = llist_args(a, builtin_unzip, 1, "l");
+	if (r)
+	{
+		return r;
+	}
+
+	// The prelude gave back its unevaluated base case
+	lval* l = a->cell[0];
+	if (llist_nil(l))
+	{
+		lval_del(a);
+		r = lval_add(lval_qexpr(), lval_opr("nil"));
+		return lval_add(r, lval_opr("nil"));
+	}
+	if ((r = llist_err("head", l)))
+	{
+		lval_del(a);
+		return r;
+	}
+
+	// Pairs are all evaluated first. An error evaluating a pair wins, then
+	// the last pair that isn't a list
+	lval** xs = malloc(sizeof(lval*) * l->count);
+	for (int i = 0; i < l->count; ++i)
+	{
+		xs[i] = llist_fst(e, l, i);
+	}
+	for (int i = 0; i < l->count && !r; ++i)
+	{
+		if (LVAL_TYPE(xs[i]) == LVAL_ERR)
+		{
+			r = lval_copy(xs[i]);
+		}
+	}
+	for (int i = l->count - 1; i >= 0 && !r; --i)
+	{
+		r = llist_err("head", xs[i]);
+	}
+
+	if (!r)
+	{
+		lval* fsts = lval_qexpr();
+		lval* snds = lval_qexpr();
+		for (int i = 0; i < l->count; ++i)
+		{
+			fsts = lval_add(fsts, lval_copy(xs[i]->cell[0]));
+			for (int j = 1; j < xs[i]->count; ++j)
+			{
+				snds = lval_add(snds, lval_copy(xs[i]->cell[j]));
+			}
+		}
+		r = lval_add(lval_add(lval_qexpr(), fsts), snds);
+	}
+
+	for (int i = 0; i < l->count; ++i)
+	{
+		lval_del(xs[i]);
+	}
+	free(xs);
+	lval_del(a);
+	return r;
+}
+
+// Packed vectors
+// A vector keeps its numbers as 64 bit integers in one buffer instead of
+// a list of values, and the arithmetic over it is done by the kernels
+// below. On x86 they come in an AVX2 version, picked at startup if the
+// processor has it, and a scalar version used otherwise (or always when
+// built with LVEC_SCALAR). Additions report when an element overflows,
+// multiplies are only given numbers that fit in 32 bits so their products
+// can't, and sums are kept as their high and low 32 bits, which can't
+// overflow either.
+
+struct lvec_kernels {
+	int (*add)(int64_t* r, int64_t* x, int64_t* y, long n);
+	void (*mul)(int64_t* r, int64_t* x, int64_t* y, long n);
+	int (*adds)(int64_t* r, int64_t* x, int64_t y, long n);
+	void (*muls)(int64_t* r, int64_t* x, int64_t y, long n);
+	int (*wide)(int64_t* x, long n);
+	void (*sum)(int64_t* x, long n, int64_t* hi, uint64_t* lo);
+	void (*dot)(int64_t* x, int64_t* y, long n, int64_t* hi, uint64_t* lo);
+	int64_t (*smallest)(int64_t* x, long n);
+	int64_t (*largest)(int64_t* x, long n);
+};
+
+// Scalar kernels, unsigned so that overflow is defined. An addition
+// overflowed if the sum's sign differs from both of the numbers added.
+int lvec_add_scalar(int64_t* r, int64_t* x, int64_t* y, long n)
+{
+	uint64_t o = 0;
+	for (long i = 0; i < n; ++i)
+	{
+		uint64_t s = (uint64_t)x[i] + (uint64_t)y[i];
+		o |= (s ^ (uint64_t)x[i]) & (s ^ (uint64_t)y[i]);
+		r[i] = (int64_t)s;
+	}
+	return (int64_t)o < 0;
+}
+
+void lvec_mul_scalar(int64_t* r, int64_t* x, int64_t* y, long n)
+{
+	for (long i = 0; i < n; ++i)
+	{
+		r[i] = (int64_t)((uint64_t)x[i] * (uint64_t)y[i]);
+	}
+}
+
+int lvec_adds_scalar(int64_t* r, int64_t* x, int64_t y, long n)
+{
+	uint64_t o = 0;
+	for (long i = 0; i < n; ++i)
+	{
+		uint64_t s = (uint64_t)x[i] + (uint64_t)y;
+		o |= (s ^ (uint64_t)x[i]) & (s ^ (uint64_t)y);
+		r[i] = (int64_t)s;
+	}
+	return (int64_t)o < 0;
+}
+
+void lvec_muls_scalar(int64_t* r, int64_t* x, int64_t y, long n)
+{
+	for (long i = 0; i < n; ++i)
+	{
+		r[i] = (int64_t)((uint64_t)x[i] * (uint64_t)y);
+	}
+}
+
+// Whether any number is outside the 32 bit range, which offset by 2^31
+// leaves something in the high half
+int lvec_wide_scalar(int64_t* x, long n)
+{
+	uint64_t o = 0;
+	for (long i = 0; i < n; ++i)
+	{
+		o |= (uint64_t)x[i] + 0x80000000u;
+	}
+	return (o >> 32) != 0;
+}
+
+void lvec_sum_scalar(int64_t* x, long n, int64_t* hi, uint64_t* lo)
+{
+	for (long i = 0; i < n; ++i)
+	{
+		*hi += x[i] >> 32;
+		*lo += (uint32_t)x[i];
+	}
+}
+
+void lvec_dot_scalar(int64_t* x, int64_t* y, long n, int64_t* hi, uint64_t* lo)
+{
+	for (long i = 0; i < n; ++i)
+	{
+		int64_t p = x[i] * y[i];
+		*hi += p >> 32;
+		*lo += (uint32_t)p;
+	}
+}
+
+int64_t lvec_min_scalar(int64_t* x, long n)
+{
+	int64_t m = x[0];
+	for (long i = 1; i < n; ++i)
+	{
+		m = min(m, x[i]);
+	}
+	return m;
+}
+
+int64_t lvec_max_scalar(int64_t* x, long n)
+{
+	int64_t m = x[0];
+	for (long i = 1; i < n; ++i)
+	{
+		m = max(m, x[i]);
+	}
+	return m;
+}
+
+struct lvec_kernels lvec_scalar = {
+	lvec_add_scalar, lvec_mul_scalar, lvec_adds_scalar, lvec_muls_scalar, lvec_wide_scalar,
+	lvec_sum_scalar, lvec_dot_scalar, lvec_min_scalar, lvec_max_scalar };
+
+#ifdef LVEC_AVX2
+// AVX2 kernels, four numbers at a time with the scalar ones finishing the
+// remainder
+#define LVEC_TARGET __attribute__((target("avx2")))
+
+// Add up the four lanes of a register
+LVEC_TARGET static inline uint64_t lvec_hsum4(__m256i x)
+{
+	uint64_t l[4];
+	_mm256_storeu_si256((__m256i*)l, x);
+	return l[0] + l[1] + l[2] + l[3];
+}
+
+// Whether any lane has its sign bit set
+LVEC_TARGET static inline int lvec_sign4(__m256i x)
+{
+	return _mm256_movemask_pd(_mm256_castsi256_pd(x)) != 0;
+}
+
+// Add the high halves of four numbers, sign extended, to 'hi' and the low
+// halves to 'lo'. AVX2 has no 64 bit arithmetic shift, so the sign of the
+// high half is put back from a 32 bit one.
+LVEC_TARGET static inline void lvec_split4(__m256i x, __m256i* hi, __m256i* lo)
+{
+	__m256i h = _mm256_blend_epi32(_mm256_srli_epi64(x, 32), _mm256_srai_epi32(x, 31), 0xaa);
+	*hi = _mm256_add_epi64(*hi, h);
+	*lo = _mm256_add_epi64(*lo, _mm256_and_si256(x, _mm256_set1_epi64x(0xffffffff)));
+}
+
+LVEC_TARGET int lvec_add_avx2(int64_t* r, int64_t* x, int64_t* y, long n)
+{
+	__m256i o = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		__m256i b = _mm256_loadu_si256((__m256i*)(y + i));
+		__m256i s = _mm256_add_epi64(a, b);
+		o = _mm256_or_si256(o, _mm256_and_si256(_mm256_xor_si256(s, a), _mm256_xor_si256(s, b)));
+		_mm256_storeu_si256((__m256i*)(r + i), s);
+	}
+	return lvec_add_scalar(r + i, x + i, y + i, n - i) | lvec_sign4(o);
+}
+
+// The numbers fit in 32 bits, so a signed 32 bit multiply gives the product
+LVEC_TARGET void lvec_mul_avx2(int64_t* r, int64_t* x, int64_t* y, long n)
+{
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		__m256i b = _mm256_loadu_si256((__m256i*)(y + i));
+		_mm256_storeu_si256((__m256i*)(r + i), _mm256_mul_epi32(a, b));
+	}
+	lvec_mul_scalar(r + i, x + i, y + i, n - i);
+}
+
+LVEC_TARGET int lvec_adds_avx2(int64_t* r, int64_t* x, int64_t y, long n)
+{
+	__m256i b = _mm256_set1_epi64x(y);
+	__m256i o = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		__m256i s = _mm256_add_epi64(a, b);
+		o = _mm256_or_si256(o, _mm256_and_si256(_mm256_xor_si256(s, a), _mm256_xor_si256(s, b)));
+		_mm256_storeu_si256((__m256i*)(r + i), s);
+	}
+	return lvec_adds_scalar(r + i, x + i, y, n - i) | lvec_sign4(o);
+}
+
+LVEC_TARGET void lvec_muls_avx2(int64_t* r, int64_t* x, int64_t y, long n)
+{
+	__m256i b = _mm256_set1_epi64x(y);
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		_mm256_storeu_si256((__m256i*)(r + i), _mm256_mul_epi32(a, b));
+	}
+	lvec_muls_scalar(r + i, x + i, y, n - i);
+}
+
+LVEC_TARGET int lvec_wide_avx2(int64_t* x, long n)
+{
+	__m256i k = _mm256_set1_epi64x(0x80000000);
+	__m256i o = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		o = _mm256_or_si256(o, _mm256_add_epi64(_mm256_loadu_si256((__m256i*)(x + i)), k));
+	}
+	o = _mm256_srli_epi64(o, 32);
+	return !_mm256_testz_si256(o, o) || lvec_wide_scalar(x + i, n - i);
+}
+
+LVEC_TARGET void lvec_sum_avx2(int64_t* x, long n, int64_t* hi, uint64_t* lo)
+{
+	__m256i h = _mm256_setzero_si256();
+	__m256i l = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		lvec_split4(_mm256_loadu_si256((__m256i*)(x + i)), &h, &l);
+	}
+	*hi += (int64_t)lvec_hsum4(h);
+	*lo += lvec_hsum4(l);
+	lvec_sum_scalar(x + i, n - i, hi, lo);
+}
+
+LVEC_TARGET void lvec_dot_avx2(int64_t* x, int64_t* y, long n, int64_t* hi, uint64_t* lo)
+{
+	__m256i h = _mm256_setzero_si256();
+	__m256i l = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		__m256i b = _mm256_loadu_si256((__m256i*)(y + i));
+		lvec_split4(_mm256_mul_epi32(a, b), &h, &l);
+	}
+	*hi += (int64_t)lvec_hsum4(h);
+	*lo += lvec_hsum4(l);
+	lvec_dot_scalar(x + i, y + i, n - i, hi, lo);
+}
+
+LVEC_TARGET int64_t lvec_min_avx2(int64_t* x, long n)
+{
+	if (n < 4)
+	{
+		return lvec_min_scalar(x, n);
+	}
+
+	__m256i m = _mm256_loadu_si256((__m256i*)x);
+	long i = 4;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		m = _mm256_blendv_epi8(m, a, _mm256_cmpgt_epi64(m, a));
+	}
+
+	int64_t l[4];
+	_mm256_storeu_si256((__m256i*)l, m);
+	int64_t r = min(min(l[0], l[1]), min(l[2], l[3]));
+	for (; i < n; ++i)
+	{
+		r = min(r, x[i]);
+	}
+	return r;
+}
+
+LVEC_TARGET int64_t lvec_max_avx2(int64_t* x, long n)
+{
+	if (n < 4)
+	{
+		return lvec_max_scalar(x, n);
+	}
+
+	__m256i m = _mm256_loadu_si256((__m256i*)x);
+	long i = 4;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+		m = _mm256_blendv_epi8(m, a, _mm256_cmpgt_epi64(a, m));
+	}
+
+	int64_t l[4];
+	_mm256_storeu_si256((__m256i*)l, m);
+	int64_t r = max(max(l[0], l[1]), max(l[2], l[3]));
+	for (; i < n; ++i)
+	{
+		r = max(r, x[i]);
+	}
+	return r;
+}
+
+// Unoptimised builds spill every register between intrinsics, which
+// leaves the multiplies and the compares slower than scalar code
+#ifdef __OPTIMIZE__
+struct lvec_kernels lvec_avx2 = {
+	lvec_add_avx2, lvec_mul_avx2, lvec_adds_avx2, lvec_muls_avx2, lvec_wide_avx2,
+	lvec_sum_avx2, lvec_dot_avx2, lvec_min_avx2, lvec_max_avx2 };
+#else
+struct lvec_kernels lvec_avx2 = {
+	lvec_add_avx2, lvec_mul_scalar, lvec_adds_avx2, lvec_muls_scalar, lvec_wide_avx2,
+	lvec_sum_avx2, lvec_dot_scalar, lvec_min_scalar, lvec_max_scalar };
+#endif
+#endif
+
+struct lvec_kernels* lvec = &lvec_scalar;
+
+// Pick the kernels for the processor we are running on
+void lvec_init(void)
+{
+#ifdef LVEC_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		lvec = &lvec_avx2;
+	}
+#endif
+}
+
+// Make a vector from a Q-Expression of integers. Vectors only hold 64 bit
+// integers, floats are numbers but are not accepted.
+lval* builtin_vec(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec", a, 1);
+	LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+	lval* l = a->cell[0];
+	for (int i = 0; i < l->count; ++i)
+	{
+		LASSERT(a, LVAL_TYPE(l->cell[i]) == LVAL_NUM,
+			"Function 'vec' passed incorrect type for element %d. Got %s, Expected Integer.",
+			i, ltype_name(LVAL_TYPE(l->cell[i])));
+		LASSERT(a, !LVAL_IS_BIG(l->cell[i]),
+			"Function 'vec' passed a number too large for element %d.", i);
+	}
+
+	lval* v = lval_vec(l->count);
+	for (int i = 0; LVAL_TYPE(v) == LVAL_VEC && i < l->count; ++i)
+	{
+		v->data[i] = LVAL_LONG(l->cell[i]);
+	}
+	lval_del(a);
+	return v;
+}
+
+// Make the vector of the numbers from 0 up to N
+lval* builtin_vec_range(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-range", a, 1);
+	LASSERT(a, LVAL_TYPE(a->cell[0]) == LVAL_NUM,
+		"Function 'vec-range' passed incorrect type for argument 0. Got %s, Expected Integer.",
+		ltype_name(LVAL_TYPE(a->cell[0])));
+	LASSERT(a, !LVAL_IS_BIG(a->cell[0]),
+		"Function 'vec-range' passed a number too large for argument %d.", 0);
+	long n = LVAL_LONG(a->cell[0]);
+	LASSERT(a, n >= 0, "Function 'vec-range' passed negative length %li.", n);
+
+	lval* v = lval_vec(n);
+	for (long i = 0; LVAL_TYPE(v) == LVAL_VEC && i < n; ++i)
+	{
+		v->data[i] = i;
+	}
+	lval_del(a);
+	return v;
+}
+
+// Turn a vector back into a Q-Expression
+lval* builtin_vec_list(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-list", a, 1);
+	LASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+
+	lval* v = a->cell[0];
+	lval* r = lval_qexpr();
+	r->cap = v->len;
+	r->cell = lmem_alloc(LMEM_CELL, sizeof(lval*) * r->cap);
+	for (long i = 0; i < v->len; ++i)
+	{
+		r->cell[r->count++] = lval_num(v->data[i]);
+	}
+	lval_del(a);
+	return r;
+}
+
+lval* builtin_vec_len(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-len", a, 1);
+	LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+	long n = a->cell[0]->len;
+	lval_del(a);
+	return lval_num(n);
+}
+
+// The number hi * 2^32 + lo that a sum kernel kept in halves, as a bignum
+// if it doesn't fit in a long
+lval* lvec_total(int64_t hi, uint64_t lo)
+{
+	hi += (int64_t)(lo >> 32);
+	lo = (uint32_t)lo;
+	if (hi <= (INT64_MAX >> 32) && hi >= (INT64_MIN >> 32))
+	{
+		return lval_num((long)(hi * ((int64_t)1 << 32) + (int64_t)lo));
+	}
+
+	uint32_t buf[2];
+	lbig h = lbig_long((long)hi, buf);
+	lbig x;
+	x.neg = h.neg;
+	x.n = h.n + 1;
+	x.d = malloc(sizeof(uint32_t) * x.n);
+	x.d[0] = 0;
+	memcpy(x.d + 1, h.d, sizeof(uint32_t) * h.n);
+
+	lbig l = lbig_long((long)lo, buf);
+	lbig r = lbig_add(x, l);
+	free(x.d);
+	return lval_big(r);
+}
+
+// Multiply elementwise when some number is beyond 32 bits, true if a
+// product overflowed
+int lvec_mul_exact(int64_t* r, int64_t* x, int64_t* y, int64_t s, long n)
+{
+	for (long i = 0; i < n; ++i)
+	{
+		long p;
+		if (lnum_mul_ovf(x[i], y ? y[i] : s, &p))
+		{
+			return 1;
+		}
+		r[i] = p;
+	}
+	return 0;
+}
+
+// Dot product when some number is beyond 32 bits. Products that fit in a
+// long are summed in halves, the rest as bignums.
+lval* lvec_dot_exact(int64_t* x, int64_t* y, long n)
+{
+	int64_t hi = 0;
+	uint64_t lo = 0;
+	lbig s = { 0, 0, NULL };
+	for (long i = 0; i < n; ++i)
+	{
+		long p;
+		if (!lnum_mul_ovf(x[i], y[i], &p))
+		{
+			hi += p >> 32;
+			lo += (uint32_t)p;
+			continue;
+		}
+
+		uint32_t xb[2], yb[2];
+		lbig q = lbig_mul(lbig_long(x[i], xb), lbig_long(y[i], yb));
+		lbig t = lbig_add(s, q);
+		free(q.d);
+		free(s.d);
+		s = t;
+	}
+
+	lval* r = lvec_total(hi, lo);
+	if (s.d)
+	{
+		uint32_t buf[2];
+		lbig t = lbig_add(s, lbig_of(r, buf));
+		free(s.d);
+		lval_del(r);
+		r = lval_big(t);
+	}
+	return r;
+}
+
+// Elementwise arithmetic of a vector with another of the same length, or
+// with a number applied to every element
+lval* lvec_op(lval* a, char* func, int mul)
+{
+	LASSERT_NUM(func, a, 2);
+	LASSERT_TYPE(func, a, 0, LVAL_VEC);
+	lval* x = a->cell[0];
+	lval* y = a->cell[1];
+	LASSERT(a, LVAL_TYPE(y) == LVAL_VEC || LVAL_TYPE(y) == LVAL_NUM,
+		"Function '%s' passed incorrect type for argument %d. Got %s, Expected %s or Integer.",
+		func, 1, ltype_name(LVAL_TYPE(y)), ltype_name(LVAL_VEC));
+	LASSERT(a, !LVAL_IS_BIG(y), "Function '%s' passed a number too large for argument %d.", func, 1);
+	LASSERT(a, LVAL_TYPE(y) == LVAL_NUM || x->len == y->len,
+		"Function '%s' passed vectors of different lengths. Got %li and %li.",
+		func, x->len, y->len);
+
+	// Write over the first vector if nothing else holds it
+	lval* r = x->refs == 1 ? lval_copy(x) : lval_vec(x->len);
+	if (LVAL_TYPE(r) == LVAL_ERR)
+	{
+		lval_del(a);
+		return r;
+	}
+
+	int64_t s = LVAL_TYPE(y) == LVAL_NUM ? LVAL_LONG(y) : 0;
+	int64_t* ys = LVAL_TYPE(y) == LVAL_NUM ? NULL : y->data;
+	int ovf;
+	if (!mul)
+	{
+		ovf = ys ? lvec->add(r->data, x->data, ys, x->len) : lvec->adds(r->data, x->data, s, x->len);
+	}
+	else if (lvec->wide(x->data, x->len) || (ys ? lvec->wide(ys, x->len) : lvec_wide_scalar(&s, 1)))
+	{
+		ovf = lvec_mul_exact(r->data, x->data, ys, s, x->len);
+	}
+	else if (ys)
+	{
+		lvec->mul(r->data, x->data, ys, x->len);
+		ovf = 0;
+	}
+	else
+	{
+		lvec->muls(r->data, x->data, s, x->len);
+		ovf = 0;
+	}
+	lval_del(a);
+
+	// Vectors only hold 64 bit numbers, so there is nothing to promote to
+	if (ovf)
+	{
+		lval_del(r);
+		return lval_err("Function '%s' gave a number too large for a vector.", func);
+	}
+	return r;
+}
+
+lval* builtin_vec_add(lenv* e, lval* a)
+{
+	return lvec_op(a, "vec-add", 0);
+}
+
+lval* builtin_vec_mul(lenv* e, lval* a)
+{
+	return lvec_op(a, "vec-mul", 1);
+}
+
+lval* builtin_vec_sum(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-sum", a, 1);
+	LASSERT_TYPE("vec-sum", a, 0, LVAL_VEC);
+	int64_t hi = 0;
+	uint64_t lo = 0;
+	lvec->sum(a->cell[0]->data, a->cell[0]->len, &hi, &lo);
+	lval_del(a);
+	return lvec_total(hi, lo);
+}
+
+lval* builtin_vec_dot(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-dot", a, 2);
+	LASSERT_TYPE("vec-dot", a, 0, LVAL_VEC);
+	LASSERT_TYPE("vec-dot", a, 1, LVAL_VEC);
+	lval* x = a->cell[0];
+	lval* y = a->cell[1];
+	LASSERT(a, x->len == y->len,
+		"Function '%s' passed vectors of different lengths. Got %li and %li.",
+		"vec-dot", x->len, y->len);
+
+	lval* r;
+	if (lvec->wide(x->data, x->len) || lvec->wide(y->data, y->len))
+	{
+		r = lvec_dot_exact(x->data, y->data, x->len);
+	}
+	else
+	{
+		int64_t hi = 0;
+		uint64_t lo = 0;
+		lvec->dot(x->data, y->data, x->len, &hi, &lo);
+		r = lvec_total(hi, lo);
+	}
+	lval_del(a);
+	return r;
+}
+
+lval* builtin_vec_min(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-min", a, 1);
+	LASSERT_TYPE("vec-min", a, 0, LVAL_VEC);
+	LASSERT(a, a->cell[0]->len != 0, "Function '%s' passed [] for argument %d.", "vec-min", 0);
+	int64_t m = lvec->smallest(a->cell[0]->data, a->cell[0]->len);
+	lval_del(a);
+	return lval_num(m);
+}
+
+lval* builtin_vec_max(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-max", a, 1);
+	LASSERT_TYPE("vec-max", a, 0, LVAL_VEC);
+	LASSERT(a, a->cell[0]->len != 0, "Function '%s' passed [] for argument %d.", "vec-max", 0);
+	int64_t m = lvec->largest(a->cell[0]->data, a->cell[0]->len);
+	lval_del(a);
+	return lval_num(m);
+}
+
+// Apply a function to every number in a vector, which must give numbers
+lval* builtin_vec_map(lenv* e, lval* a)
+{
+	LASSERT_NUM("vec-map", a, 2);
+	LASSERT_TYPE("vec-map", a, 0, LVAL_FUN);
+	LASSERT_TYPE("vec-map", a, 1, LVAL_VEC);
+
+	lval* f = a->cell[0];
+	lval* x = a->cell[1];
+	lval* r = lval_vec(x->len);
+	for (long i = 0; LVAL_TYPE(r) == LVAL_VEC && i < x->len; ++i)
+	{
+		lval* y = llist_call(e, f, lval_num(x->data[i]), NULL);
+		if (LVAL_TYPE(y) != LVAL_NUM || LVAL_IS_BIG(y))
+		{
+			lval* err = LVAL_TYPE(y) == LVAL_ERR ? lval_copy(y)
+				: LVAL_IS_BIG(y) ? lval_err("Function 'vec-map' got a number too large from its function.")
+				: lval_err("Function 'vec-map' got %s from its function, Expected Integer.",
+					ltype_name(LVAL_TYPE(y)));
+			lval_del(y);
+			lval_del(r);
+			lval_del(a);
+			return err;
+		}
+		r->data[i] = LVAL_LONG(y);
+		lval_del(y);
+	}
+	lval_del(a);
+	return r;
+}
+
+// Converts S-Expression into Q-Expression
+lval* builtin_list(lenv* e, lval* a)
+{
+	a->type = LVAL_QEXPR;
+	return a;
+}
+
+// Returns the Q-Expression 'eval' is given as an S-Expression, or an error
+lval* lval_eval_expr(lval* a)
+{
+	LASSERT_NUM("eval", a, 1);
+
+	LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+
+
+	lval* x = lval_own(lval_take(a, 0));
+	x->type = LVAL_SEXPR;
+	return x;
+}
+
+// Converts Q-Expression into S-Expression and evaluates using lval_eval()
+lval* builtin_eval(lenv* e, lval* a)
+{
+	return lval_eval(e, lval_eval_expr(a));
+}
+
+// Joins Q-Expressions and returns a Q-Expression
+lval* builtin_join(lenv* e, lval* a)
+{
+	for (int i = 0; i < a->count; ++i)
+	{
+		LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+	}
+
+	lval* x = lval_pop(a, 0);
+
+	while (a->count)
+	{
+		lval* y = lval_pop(a, 0);
+		x = lval_join(x, y);
+	}
+
+	lval_del(a);
+	return x;
+}
+
+// Joins 2 Q-Exressions to one Q-Expression
+lval* lval_join(lval* x, lval* y)
+{
+	// A shared 'y' keeps its elements, 'x' shares them instead
+	if (y->refs > 1 || LVAL_IS_VIEW(y))
+	{
+		for (int i = 0; i < y->count; ++i)
+		{
+			x = lval_add(x, lval_copy(y->cell[i]));
+		}
+		lval_del(y);
+		return x;
+	}
+
+	// For each cell in 'y' add it to 'x'
+	for (int i = 0; i < y->count; ++i)
+	{
+		x = lval_add(x, y->cell[i]);
+	}
+
+	// Delete the empty 'y' and return 'x'
+	y->count = 0;
+	lval_del(y);
+	return x;
+}
+
+// Apply an S-Expression whose children have been evaluated. Returns the
+// result, or NULL when a call in tail position continues with '*v' in
+// '*e' instead. Functions entered that way are kept in '*frames' until
+// the evaluation returns, since callees look operators up through their
+// caller's environment. A frame is dropped early once a function called
+// above it binds all of its operators anyway.
+lval* lval_apply(lenv** e, lval** v, lval** frames)
+{
+	lval* x = *v;
+
+	// Error checking
+	for (int i = 0; i < x->count; ++i)
+	{
+		if (LVAL_TYPE(x->cell[i]) == LVAL_ERR)
+		{
+			return lval_take(x, i);
+		}
+	}
+
+	// Empty Expression
+	if (x->count == 0)
+	{
+		return x;
+	}
+
+	// Single Expression
+	if (x->count == 1)
+	{
+		return lval_take(x, 0);
+	}
+
+	// Builtins taking an argument vector are given the children in place
+	lval* f = x->cell[0];
+	if (LVAL_TYPE(f) == LVAL_FUN && f->call)
+	{
+		lcall_depth++;
+		lval* r = f->call(*e, x->count - 1, x->cell + 1);
+		lcall_depth--;
+		lval_del(x);
+		return r;
+	}
+
+	// Ensure first element is symbol
+	f = lval_pop(x, 0);
+	if (LVAL_TYPE(f) != LVAL_FUN)
+	{
+		lval* err = lval_err("S-Expression starts with incorrect type! Got %s, Expected %s.", 
+			ltype_name(LVAL_TYPE(f)), ltype_name(LVAL_FUN));
+		lval_del(f);
+		lval_del(x);
+		return err;
+	}
+
+	// 'if' and 'eval' continue with the expression they would evaluate
+	if (f->builtin == builtin_if || f->builtin == builtin_eval)
+	{
+		x = f->builtin == builtin_if ? lval_if_expr(x) : lval_eval_expr(x);
+		lval_del(f);
+		if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			return x;
+		}
+		*v = x;
+		return NULL;
+	}
+
+	// Call builtin with operator
+	if (f->builtin)
+	{
+		lval* result = lval_call(*e, f, x);
+		lval_del(f);
+		return result;
+	}
+
+	// User functions bind their arguments so need their own copy,
+	// compile the shared original first so the code is kept
+	if (lvm.enabled && !f->code)
+	{
+		lvm_compile_fun(f);
+	}
+	f = lval_own(f);
+
+	// Return errors and partially evaluated functions
+	lval* r = lval_bind(*e, f, x);
+	if (r)
+	{
+		lval_del(f);
+		return r;
+	}
+
+	// Frames the callee hides can't be reached through it any more
+	lval* fs = *frames;
+	for (int i = fs ? fs->count - 1 : -1; i >= 0; --i)
+	{
+		lenv* y = fs->cell[i]->env;
+		if (lenv_covers(f->env, y))
+		{
+			if (i == fs->count - 1)
+			{
+				*e = y->par;
+			}
+			else
+			{
+				fs->cell[i + 1]->env->par = y->par;
+			}
+			lval_del(lval_pop(fs, i));
+		}
+	}
+	f->env->par = *e;
+	*frames = lval_add(fs ? fs : lval_sexpr(), f);
+	*e = f->env;
+
+	// Compiled code keeps its own frames from here
+	if (f->code)
+	{
+		return lvm_run(f->code, *e);
+	}
+
+	// Evaluate the body in the function's environment
+	x = lval_own(lval_copy(f->body));
+	x->type = LVAL_SEXPR;
+	*v = x;
+	return NULL;
+}
+
+// Call a function with arguments that are already evaluated, given as
+// an S-Expression
+lval* lval_invoke(lenv* e, lval* v)
+{
+	lval* frames = NULL;
+	lval* result = lval_apply(&e, &v, &frames);
+	if (!result)
+	{
+		lgc_push_root(&frames);
+		result = lval_eval(e, v);
+		lgc_pop_root();
+	}
+
+	if (frames)
+	{
+		lval_del(frames);
+	}
+	return result;
+}
+
+// Evaluate a Sexpr and return a lval*
+// Calls in tail position don't recurse: the branch of an 'if', the
+// expression given to 'eval' and the body of a user defined function
+// replace the S-Expression being evaluated.
+lval* lval_eval_sexpr(lenv* e, lval* v)
+{
+	lval* frames = NULL;
+	lval* result = NULL;
+	lgc_push_env(&e);
+	lgc_push_root(&v);
+	lgc_push_root(&frames);
+
+	while (!result)
+	{
+		// Between calls everything in use is rooted
+		lgc_safepoint(e);
+
+		// A single S-Expression is evaluated in place of this one
+		if (v->count == 1 && LVAL_TYPE(v->cell[0]) == LVAL_SEXPR)
+		{
+			v = lval_take(v, 0);
+			continue;
+		}
+
+		// A shared expression would have to be copied to evaluate its
+		// children in place, small ones are evaluated onto the C stack
+		if ((v->refs > 1 || LVAL_IS_VIEW(v)) && v->count > 1 && v->count <= LARGS_MAX)
+		{
+			lval* argv[LARGS_MAX] = { NULL };
+			int n = v->count;
+			int ok = 1;
+			lgc_push_roots(argv, n);
+			for (int i = 0; i < n; ++i)
+			{
+				argv[i] = lval_eval(e, lval_copy(v->cell[i]));
+				ok = ok && LVAL_TYPE(argv[i]) != LVAL_ERR;
+			}
+			lgc_pop_root();
+			lval_del(v);
+
+			// So builtins taking an argument vector need no list at all
+			if (ok && LVAL_TYPE(argv[0]) == LVAL_FUN && argv[0]->call)
+			{
+				lcall_depth++;
+				result = argv[0]->call(e, n - 1, argv + 1);
+				lcall_depth--;
+				for (int i = 0; i < n; ++i)
+				{
+					lval_del(argv[i]);
+				}
+				break;
+			}
+
+			// Anything else is applied as usual
+			v = lval_sexpr();
+			v->count = n;
+			v->cap = n;
+			v->cell = lmem_alloc(LMEM_CELL, sizeof(lval*) * n);
+			memcpy(v->cell, argv, sizeof(lval*) * n);
+		}
+		else
+		{
+			// Children are replaced in place
+			v = lval_own(v);
+			for (int i = 0; i < v->count; ++i)
+			{
+				v->cell[i] = lval_eval(e, v->cell[i]);
+			}
+		}
+
+		result = lval_apply(&e, &v, &frames);
+	}
+
+	lgc_pop_root();
+	lgc_pop_root();
+	lgc_pop_env();
+	if (frames)
+	{
+		lval_del(frames);
+	}
+	return result;
+}
+
+// Add a new function for every operator/function
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func)
+{
+	lval* k = lval_opr(name);
+	lval* v = lval_builtin(func);
+	lenv_put(e, k, v);
+	lval_del(k);
+	lval_del(v);
+}
+
+// Add a builtin that can also be called with an argument vector
+void lenv_add_builtinv(lenv* e, char* name, lbuiltin func, lbuiltinv call)
+{
+	lval* k = lval_opr(name);
+	lval* v = lval_builtin(func);
+	v->call = call;
+	lenv_put(e, k, v);
+	lval_del(k);
+	lval_del(v);
+}
+
+// Add the new builtins
+void lenv_add_builtins(lenv* e)
+{
+	// List functions
+	lenv_add_builtin(e, "list", builtin_list);
+	lenv_add_builtin(e, "head", builtin_head);
+	lenv_add_builtin(e, "tail", builtin_tail);
+	lenv_add_builtin(e, "eval", builtin_eval);
+	lenv_add_builtin(e, "join", builtin_join);
+
+	// List Functions
+	lenv_add_builtin(e, "len", builtin_len);
+	lenv_add_builtin(e, "nth", builtin_nth);
+	lenv_add_builtin(e, "last", builtin_last);
+	lenv_add_builtin(e, "map", builtin_map);
+	lenv_add_builtin(e, "filter", builtin_filter);
+	lenv_add_builtin(e, "reverse", builtin_reverse);
+	lenv_add_builtin(e, "foldl", builtin_foldl);
+	lenv_add_builtin(e, "foldr", builtin_foldr);
+	lenv_add_builtin(e, "take", builtin_take);
+	lenv_add_builtin(e, "drop", builtin_drop);
+	lenv_add_builtin(e, "elem", builtin_elem);
+	lenv_add_builtin(e, "lookup", builtin_lookup);
+	lenv_add_builtin(e, "zip", builtin_zip);
+	lenv_add_builtin(e, "unzip", builtin_unzip);
+
+	// Vector Functions
+	lenv_add_builtin(e, "vec", builtin_vec);
+	lenv_add_builtin(e, "vec-range", builtin_vec_range);
+	lenv_add_builtin(e, "vec-list", builtin_vec_list);
+	lenv_add_builtin(e, "vec-len", builtin_vec_len);
+	lenv_add_builtin(e, "vec-add", builtin_vec_add);
+	lenv_add_builtin(e, "vec-mul", builtin_vec_mul);
+	lenv_add_builtin(e, "vec-sum", builtin_vec_sum);
+	lenv_add_builtin(e, "vec-dot", builtin_vec_dot);
+	lenv_add_builtin(e, "vec-min", builtin_vec_min);
+	lenv_add_builtin(e, "vec-max", builtin_vec_max);
+	lenv_add_builtin(e, "vec-map", builtin_vec_map);
+
+	// Mathematical functions
+	lenv_add_builtinv(e, "+", builtin_add, builtinv_add);
+	lenv_add_builtinv(e, "-", builtin_sub, builtinv_sub);
+	lenv_add_builtinv(e, "*", builtin_mul, builtinv_mul);
+	lenv_add_builtinv(e, "/", builtin_div, builtinv_div);
+	lenv_add_builtinv(e, "%", builtin_mod, builtinv_mod);
+	lenv_add_builtinv(e, "^", builtin_pow, builtinv_pow);
+	lenv_add_builtinv(e, "min", builtin_min, builtinv_min);
+	lenv_add_builtinv(e, "max", builtin_max, builtinv_max);
+	lenv_add_builtin(e, "sqrt", builtin_sqrt);
+	lenv_add_builtin(e, "exp", builtin_exp);
+	lenv_add_builtin(e, "log", builtin_log);
+	lenv_add_builtin(e, "sin", builtin_sin);
+	lenv_add_builtin(e, "cos", builtin_cos);
+	lenv_add_builtin(e, "tan", builtin_tan);
+	lenv_add_builtin(e, "atan", builtin_atan);
+	lenv_add_builtin(e, "float", builtin_float);
+	lenv_add_builtin(e, "floor", builtin_floor);
+	lenv_add_builtin(e, "ceil", builtin_ceil);
+	lenv_add_builtin(e, "round", builtin_round);
+	lenv_add_builtin(e, "trunc", builtin_trunc);
+
+	// Variable functions
+	lenv_add_builtin(e, "\\", builtin_lambda);
+	lenv_add_builtin(e, "def", builtin_def);
+	lenv_add_builtin(e, "=", builtin_put);
+
+	// Comparison functions
+	lenv_add_builtin(e, "if", builtin_if);
+	lenv_add_builtinv(e, "==", builtin_eq, builtinv_eq);
+	lenv_add_builtinv(e, "!=", builtin_ne, builtinv_ne);
+	lenv_add_builtinv(e, ">", builtin_gt, builtinv_gt);
+	lenv_add_builtinv(e, "<", builtin_lt, builtinv_lt);
+	lenv_add_builtinv(e, ">=", builtin_ge, builtinv_ge);
+	lenv_add_builtinv(e, "<=", builtin_le, builtinv_le);
+
+	// Logical Operators
+	lenv_add_builtinv(e, "and", builtin_and, builtinv_and);
+	lenv_add_builtinv(e, "or", builtin_or, builtinv_or);
+	lenv_add_builtinv(e, "not", builtin_not, builtinv_not);
+
+	// String Functions
+	lenv_add_builtin(e, "load", builtin_load);
+	lenv_add_builtin(e, "error", builtin_error);
+	lenv_add_builtin(e, "print", builtin_print);
+
+	// Interpreter functions
+	lenv_add_builtin(e, "mem-stats", builtin_mem_stats);
+
+}
+
+
+// Define functions(builtin)
+lval* builtin_var(lenv* e, lval* a, char* func)
+{
+	LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+
+	// First argument is operator list
+	lval* oprs = a->cell[0];
+
+	// Ensure all elements of the first list are sybmols
+	for (int i = 0; i < oprs->count; ++i)
+	{
+		LASSERT(a, (LVAL_TYPE(oprs->cell[i]) == LVAL_OPR), 
+			"Function 'def' cannot define non-operator! Got %s, Expected %s", 
+			ltype_name(LVAL_TYPE(oprs->cell[i])), ltype_name(LVAL_OPR));
+	}
+
+	// Check correct number of symbols and values
+	LASSERT(a, (oprs->count == a->count - 1), 
+		"Function 'def' passed too many arguments for operators! Got %d, Expected %d.", 
+		oprs->count, a->count - 1);
+		
+	// Assign copies of values to operators
+	for (int i = 0; i < oprs->count; ++i)
+	{
+		if (strcmp(func, "def") == 0)
+		{
+			lenv_def(e, oprs->cell[i], a->cell[i + 1]);
+		}
+
+		if (strcmp(func, "=") == 0)
+		{
+			lenv_put(e, oprs->cell[i], a->cell[i + 1]);
+		}
+	}
+
+	lval_del(a);
+	return lval_sexpr();
+}
+
+// Print the lines provided from a file
+lval* builtin_print(lenv* e, lval* a)
+{
+	// Print each argument followed by a space
+	for (int i = 0; i < a->count; ++i)
+	{
+		lval_print(a->cell[i]);
+		putchar(' ');
+	}
+	
+	// Print a newline and delete arguments
+	putchar('\n');
+	lval_del(a);	
+
+	return lval_sexpr();
+}
+
+// Print the allocator counters, arguments are ignored so it can be
+// called as (mem-stats ())
+lval* builtin_mem_stats(lenv* e, lval* a)
+{
+	char* kinds[LMEM_KINDS] = { "lval", "lenv", "cell" };
+
+	for (int i = 0; i < LMEM_KINDS; ++i)
+	{
+		struct lmem_stat* s = &lmem_stats[i];
+		printf("%-5s %10ld live %12ld allocated %10ld bytes\n",
+			kinds[i], s->allocs - s->frees, s->allocs, s->bytes);
+	}
+	printf("slabs %10ld (%ld KiB)\n", lslab_count, lslab_count * (LSLAB_BYTES / 1024));
+	if (lgc.enabled)
+	{
+		printf("gc    %10ld collections %6ld values %6ld environments\n",
+			lgc.collections, lgc.nvals, lgc.nenvs);
+	}
+	if (lnursery.enabled)
+	{
+		printf("young %10ld live %12ld allocated %10ld promoted %ld resets\n",
+			lnursery.live, lnursery.allocs, lnursery.promoted, lnursery.resets);
+	}
+	printf("frame %10ld reused\n", lframes.reused);
+
+	lval_del(a);
+	return lval_sexpr();
+}
+
+// Print an error in a string provided by the user
+lval* builtin_error(lenv* e, lval* a)
+{
+	LASSERT_NUM("error", a, 1);
+	LASSERT_TYPE("error", a, 0, LVAL_STR);
+
+	// Construct error from first argument
+	lval* err = lval_err(a->cell[0]->str);
+
+	// Delete arguments and return
+	lval_del(a);
+	return err;
+}
+
+// Call user defined functions
+lval* lval_call(lenv* e, lval* f, lval* a)
+{
+	// If builtin then simply call that function
+	if (f->builtin)
+	{
+		lcall_depth++;
+		lval* r = f->builtin(e, a);
+		lcall_depth--;
+		return r;
+	}
+
+	// Return errors and partially evaluated functions
+	lval* r = lval_bind(e, f, a);
+	if (r)
+	{
+		return r;
+	}
+
+	// Set environment parent to evaluation environment
+	f->env->par = e;
+
+	// Run the compiled body if there is one, the function is kept while
+	// it runs
+	lgc_push_root(&f);
+	if (f->code)
+	{
+		r = lvm_run(f->code, f->env);
+	}
+	else
+	{
+		// Evaluate and return
+		r = builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+	}
+	lgc_pop_root();
+	return r;
+}
+
+// Bind arguments into a user defined function's environment, returns
+// NULL once every formal is bound and the body should be evaluated
+lval* lval_bind(lenv* e, lval* f, lval* a)
+{
+	// Save the argument counts
+	int given = a->count;
+	int total = f->formals->count;
+
+	// Simple functions bind every argument straight into its slot
+	if (f->arity == given && f->env->count == 0)
+	{
+		lenv_bind(f->env, f->formals->cell, a->cell, given);
+		lval_del(a);
+		return NULL;
+	}
+
+	// Formals are consumed as they are bound
+	f->formals = lval_own(f->formals);
+
+	// While there are arguments to be processed
+	while (a->count)
+	{
+		// If we ran out of formal arguments to bind
+		if (f->formals->count == 0)
+		{
+			lval_del(a); 
+			return lval_err("Function passed too many arguments! Got %d, Expected %d.", given, total);
+		}
+		
+		// Pop the first operator from the formals
+		lval* opr = lval_pop(f->formals, 0);
+
+		// Special case to deal with '&'
+		if (opr->opr == lsym_amp)
+		{
+			// Ensure '&' is followed by another operator
+			if (f->formals->count != 1)
+			{
+				lval_del(a);
+				return lval_err("Function formal invalid! Operator '&' not followed by a single operator.");
+			}
+
+			// Next formal should be bound to remaining arguments
+			lval* nopr = lval_pop(f->formals, 0);
+			lenv_put(f->env, nopr, builtin_list(e, a));
+			lval_del(opr);
+			lval_del(nopr);
+			break;
+		}
+
+		// Pop the next argument from the list
+		lval* val = lval_pop(a, 0);
+
+		// Bind a copy into the function's environment
+		lenv_put(f->env, opr, val);
+
+		// Delete operator and value
+		lval_del(opr);
+		lval_del(val);
+
+	}
+
+	// Argument list is now bound so clean it
+	lval_del(a);
+
+	// If '&' remain in formal list bind to empty list
+	if (f->formals->count > 0 && f->formals->cell[0]->opr == lsym_amp)
+	{
+		// Check to ensure that '&' is not passed invalidly
+		if (f->formals->count != 2)
+		{
+			return lval_err("Function format invalid! Symbol '&' no followed by a single symbol.");
+		}
+
+		// Pop and delete '&' symbol
+		lval_del(lval_pop(f->formals, 0));
+
+		// Pop next operator and create empty list
+		lval* opr = lval_pop(f->formals, 0);
+		lval* val = lval_qexpr();
+
+		// Bind to environment and delete
+		lenv_put(f->env, opr, val);
+		lval_del(opr);
+		lval_del(val);
+	}
+
+	// If all formals have been bound the body is ready to evaluate
+	if (f->formals->count == 0)
+	{
+		return NULL;
+	}
+	else
+	{
+		// Otherwise return partially evaluated function
+		return lval_copy(f);
+	}
+
+}
+
+// Explicit-stack evaluator (selected with --cek)
+// Evaluates S-Expressions exactly like lval_eval_sexpr, but every
+// S-Expression whose children are being evaluated is a frame on a heap
+// allocated stack instead of a C call. Non-tail recursion is then limited
+// by the depth limit (--max-depth) and memory, not the C stack.
+#ifndef LCEK_DEPTH
+#define LCEK_DEPTH 1000000
+#endif
+
+struct lkont {
+	lenv* e;
+	lval* v;
+	int i;
+	lval* frames;
+};
+
+struct lcek {
+	int enabled;
+	int limit;
+	struct lkont* stack;
+	int sp;
+	int cap;
+};
+
+struct lcek lcek = { 0, LCEK_DEPTH, NULL, 0, 0 };
+
+// Push a frame evaluating the children of an S-Expression
+void lcek_push(lenv* e, lval* v)
+{
+	if (lcek.sp == lcek.cap)
+	{
+		lcek.cap = lcek.cap ? lcek.cap * 2 : 64;
+		lcek.stack = realloc(lcek.stack, sizeof(struct lkont) * lcek.cap);
+	}
+
+	struct lkont* k = &lcek.stack[lcek.sp++];
+	k->e = e;
+	k->v = v;
+	k->i = 0;
+	k->frames = NULL;
+}
+
+// Pop the top frame, freeing the functions it entered
+void lcek_pop(void)
+{
+	struct lkont* k = &lcek.stack[--lcek.sp];
+	if (k->frames)
+	{
+		lval_del(k->frames);
+	}
+}
+
+// The collector keeps every frame on the stack
+void lgc_mark_cek(void)
+{
+	for (int i = 0; i < lcek.sp; ++i)
+	{
+		lgc_mark_chain(lcek.stack[i].e);
+		lgc_mark(lcek.stack[i].v);
+		if (lcek.stack[i].frames)
+		{
+			lgc_mark(lcek.stack[i].frames);
+		}
+	}
+}
+
+lval* lcek_eval(lenv* e, lval* v)
+{
+	// Nested runs (from 'load') share the stack above this one
+	int base = lcek.sp;
+	lcek_push(e, v);
+
+	while (1)
+	{
+		// Everything in use is on the stack between steps
+		lgc_safepoint(lcek.stack[lcek.sp - 1].e);
+
+		// The stack may move as it grows, so index it afresh
+		struct lkont* k = &lcek.stack[lcek.sp - 1];
+		if (k->i == 0)
+		{
+			// Children are replaced in place
+			k->v = lval_own(k->v);
+
+			// A single S-Expression is evaluated in place of this one
+			if (k->v->count == 1 && LVAL_TYPE(k->v->cell[0]) == LVAL_SEXPR)
+			{
+				k->v = lval_take(k->v, 0);
+				continue;
+			}
+		}
+
+		// Evaluate children, descending into S-Expressions
+		while (k->i < k->v->count && LVAL_TYPE(k->v->cell[k->i]) != LVAL_SEXPR)
+		{
+			k->v->cell[k->i] = lval_eval(k->e, k->v->cell[k->i]);
+			k->i++;
+		}
+		if (k->i < k->v->count)
+		{
+			if (lcek.sp - base >= lcek.limit)
+			{
+				// Unwind this run
+				while (lcek.sp > base)
+				{
+					lval_del(lcek.stack[lcek.sp - 1].v);
+					lcek_pop();
+				}
+				return lval_err("Maximum evaluation depth of %d exceeded!", lcek.limit);
+			}
+
+			// The child's value takes its place when the frame returns
+			lval* c = k->v->cell[k->i];
+			k->v->cell[k->i] = LVAL_FIX(0);
+			lcek_push(k->e, c);
+			continue;
+		}
+
+		lval* r = lval_apply(&k->e, &k->v, &k->frames);
+		if (!r)
+		{
+			// Tail call, evaluate the new S-Expression in this frame
+			k->i = 0;
+			continue;
+		}
+
+		// Return the value to the frame below
+		lcek_pop();
+		if (lcek.sp == base)
+		{
+			return r;
+		}
+		k = &lcek.stack[lcek.sp - 1];
+		lval_del(k->v->cell[k->i]);
+		k->v->cell[k->i++] = r;
+	}
+}
+
+// lval* evaluator
+lval* lval_eval(lenv* e, lval* v)
+{
+	if (LVAL_TYPE(v) == LVAL_OPR)
+	{
+		lval* x = lenv_get(e, v);
+		lval_del(v);
+		return x;
+	}
+
+	if (LVAL_TYPE(v) == LVAL_SEXPR)
+	{
+		return lcek.enabled ? lcek_eval(e, v) : lval_eval_sexpr(e, v);
+	}
+	
+	return v;
+}
+
+// Bytecode compiler and stack VM (selected with --vm)
+// Lambda bodies are compiled on their first call and the code is kept on
+// the function. Operators that are formals of the function are loaded
+// from their slot in the call environment (checking the slot still holds
+// that operator), others are looked up by name like lenv_get with an
+// inline cache of their position in the global environment. 'if' with
+// literal branches and the arithmetic and comparison builtins get their
+// own instructions, guarded by a check that the operator still names the
+// builtin; otherwise they behave exactly like any other S-Expression.
+enum { OP_CONST, OP_EMPTY, OP_LOAD, OP_LOCAL, OP_SEXPR, OP_TAIL, OP_ARITH,
+	OP_IF, OP_TEST, OP_JUMP, OP_RETURN };
+
+enum { LARITH_ADD, LARITH_SUB, LARITH_MUL, LARITH_GT, LARITH_LT,
+	LARITH_GE, LARITH_LE, LARITH_EQ, LARITH_NE, LARITH_KINDS };
+
+// Operators given their own instructions
+char* lsym_if;
+
+struct larith {
+	char* name;
+	lbuiltin func;
+	char* sym;
+};
+
+struct larith lariths[LARITH_KINDS] = {
+	{ "+", builtin_add }, { "-", builtin_sub }, { "*", builtin_mul },
+	{ ">", builtin_gt }, { "<", builtin_lt }, { ">=", builtin_ge },
+	{ "<=", builtin_le }, { "==", builtin_eq }, { "!=", builtin_ne },
+};
+
+void lvm_init(void)
+{
+	lsym_if = lsym_intern("if", 2, lhash("if", 2));
+	for (int i = 0; i < LARITH_KINDS; ++i)
+	{
+		size_t n = strlen(lariths[i].name);
+		lariths[i].sym = lsym_intern(lariths[i].name, n, lhash(lariths[i].name, n));
+	}
+}
+
+lcode* lcode_new(void)
+{
+	lcode* c = malloc(sizeof(lcode));
+	c->refs = 1;
+	c->count = 0;
+	c->cap = 0;
+	c->ops = NULL;
+	c->nconsts = 0;
+	c->capconsts = 0;
+	c->consts = NULL;
+	c->depth = 0;
+	c->maxdepth = 0;
+	c->arity = -1;
+	return c;
+}
+
+// Drop a reference to compiled code
+void lcode_del(lcode* c)
+{
+	if (!c || --c->refs > 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < c->nconsts; ++i)
+	{
+		lval_del(c->consts[i]);
+	}
+	free(c->consts);
+	free(c->ops);
+	free(c);
+}
+
+void lgc_mark_code(lcode* c)
+{
+	if (!c)
+	{
+		return;
+	}
+	for (int i = 0; i < c->nconsts; ++i)
+	{
+		lgc_mark(c->consts[i]);
+	}
+}
+
+// Append an instruction or operand, returning its position
+int lcode_emit(lcode* c, int op)
+{
+	if (c->count == c->cap)
+	{
+		c->cap = c->cap ? c->cap * 2 : 16;
+		c->ops = realloc(c->ops, sizeof(int) * c->cap);
+	}
+	c->ops[c->count] = op;
+	return c->count++;
+}
+
+// Add a constant, sharing the value
+int lcode_const(lcode* c, lval* v)
+{
+	if (c->nconsts == c->capconsts)
+	{
+		c->capconsts = c->capconsts ? c->capconsts * 2 : 8;
+		c->consts = realloc(c->consts, sizeof(lval*) * c->capconsts);
+	}
+	c->consts[c->nconsts] = lval_copy(v);
+	return c->nconsts++;
+}
+
+// Track the stack depth the instructions need
+void lcode_push(lcode* c, int n)
+{
+	c->depth += n;
+	c->maxdepth = max(c->maxdepth, c->depth);
+}
+
+void lcode_expr(lcode* c, lval* v, lenv* bound, lval* formals);
+
+// Slot an operator will be bound to when the function is called, or -1
+int lcode_slot(lenv* bound, lval* formals, lval* k)
+{
+	int i = bound ? lenv_find(bound, k) : -1;
+	if (i != -1)
+	{
+		return i;
+	}
+
+	int slot = bound ? bound->count : 0;
+	for (int j = 0; formals && j < formals->count; ++j)
+	{
+		if (formals->cell[j]->opr == k->opr)
+		{
+			return slot;
+		}
+		if (formals->cell[j]->opr != lsym_amp)
+		{
+			slot++;
+		}
+	}
+	return -1;
+}
+
+// Compile the evaluation of an S-Expression given as its cells, in tail
+// position its value is returned by the code
+void lcode_sexpr(lcode* c, lval** cells, int n, lenv* bound, lval* formals, int tail)
+{
+	if (n == 0)
+	{
+		lcode_emit(c, OP_EMPTY);
+		lcode_push(c, 1);
+		return;
+	}
+
+	// A single expression evaluates to its element
+	if (n == 1)
+	{
+		if (LVAL_TYPE(cells[0]) == LVAL_SEXPR)
+		{
+			lcode_sexpr(c, cells[0]->cell, cells[0]->count, bound, formals, tail);
+		}
+		else
+		{
+			lcode_expr(c, cells[0], bound, formals);
+		}
+		return;
+	}
+
+	lval* h = cells[0];
+	if (LVAL_TYPE(h) == LVAL_OPR)
+	{
+		// (if cond {then} {else})
+		if (h->opr == lsym_if && n == 4
+			&& LVAL_TYPE(cells[2]) == LVAL_QEXPR && LVAL_TYPE(cells[3]) == LVAL_QEXPR)
+		{
+			lcode_expr(c, h, bound, formals);
+			lcode_emit(c, OP_IF);
+			int generic = lcode_emit(c, 0);
+			c->depth--;
+
+			lcode_expr(c, cells[1], bound, formals);
+			lcode_emit(c, OP_TEST);
+			int other = lcode_emit(c, 0);
+			int end1 = lcode_emit(c, 0);
+			c->depth--;
+
+			lval* t = cells[2];
+			lcode_sexpr(c, t->cell, t->count, bound, formals, tail);
+			lcode_emit(c, OP_JUMP);
+			int end2 = lcode_emit(c, 0);
+			c->depth--;
+
+			c->ops[other] = c->count;
+			lval* o = cells[3];
+			lcode_sexpr(c, o->cell, o->count, bound, formals, tail);
+			lcode_emit(c, OP_JUMP);
+			int end3 = lcode_emit(c, 0);
+			c->depth--;
+
+			// Operator is no longer builtin 'if', head is still pushed
+			c->ops[generic] = c->count;
+			c->depth++;
+			for (int i = 1; i < n; ++i)
+			{
+				lcode_expr(c, cells[i], bound, formals);
+			}
+			lcode_emit(c, tail ? OP_TAIL : OP_SEXPR);
+			lcode_emit(c, n);
+			c->depth -= n - 1;
+
+			c->ops[end1] = c->ops[end2] = c->ops[end3] = c->count;
+			return;
+		}
+
+		// Arithmetic and comparisons
+		for (int k = 0; k < LARITH_KINDS; ++k)
+		{
+			int binary = k >= LARITH_GT;
+			if (h->opr == lariths[k].sym && (binary ? n == 3 : n >= 2))
+			{
+				for (int i = 0; i < n; ++i)
+				{
+					lcode_expr(c, cells[i], bound, formals);
+				}
+				lcode_emit(c, OP_ARITH);
+				lcode_emit(c, k);
+				lcode_emit(c, n);
+				c->depth -= n - 1;
+				return;
+			}
+		}
+	}
+
+	for (int i = 0; i < n; ++i)
+	{
+		lcode_expr(c, cells[i], bound, formals);
+	}
+	lcode_emit(c, tail ? OP_TAIL : OP_SEXPR);
+	lcode_emit(c, n);
+	c->depth -= n - 1;
+}
+
+// Compile the evaluation of any value
+void lcode_expr(lcode* c, lval* v, lenv* bound, lval* formals)
+{
+	switch (LVAL_TYPE(v))
+	{
+	case LVAL_OPR:
+	{
+		int slot = lcode_slot(bound, formals, v);
+		lcode_emit(c, slot == -1 ? OP_LOAD : OP_LOCAL);
+		lcode_emit(c, lcode_const(c, v));
+		lcode_emit(c, slot);
+		lcode_push(c, 1);
+		break;
+	}
+	case LVAL_SEXPR:
+		lcode_sexpr(c, v->cell, v->count, bound, formals, 0);
+		break;
+	default:
+		lcode_emit(c, OP_CONST);
+		lcode_emit(c, lcode_const(c, v));
+		lcode_push(c, 1);
+		break;
+	}
+}
+
+// Compile the body of a user defined function
+void lvm_compile_fun(lval* f)
+{
+	lcode* c = lcode_new();
+	lcode_sexpr(c, f->body->cell, f->body->count, f->env, f->formals, 1);
+	lcode_emit(c, OP_RETURN);
+
+	// Simple functions have nothing bound yet
+	c->arity = f->env->count == 0 ? f->arity : -1;
+	f->code = c;
+}
+
+// Look up an operator by name, caching its index in the global environment
+lval* lvm_load(lenv* e, lval* k, int* cache)
+{
+	for (; e->par; e = e->par)
+	{
+		int i = lenv_find(e, k);
+		if (i != -1)
+		{
+			return lval_copy(e->vals[i]);
+		}
+	}
+
+	int i = *cache;
+	if (i < 0 || i >= e->count || e->oprs[i] != k->opr)
+	{
+		i = lenv_find(e, k);
+		if (i == -1)
+		{
+			return lval_err("Unbound operator '%s'!", k->opr);
+		}
+		*cache = i;
+	}
+	return lval_copy(e->vals[i]);
+}
+
+lval* lvm_run(lcode* c, lenv* e);
+
+// Evaluate the S-Expression made of the top n values of the stack,
+// exactly like lval_eval_sexpr
+lval* lvm_sexpr(lenv* e, int n)
+{
+	lvm.sp -= n;
+	lval** args = &lvm.stack[lvm.sp];
+
+	// Error checking
+	for (int i = 0; i < n; ++i)
+	{
+		if (LVAL_TYPE(args[i]) == LVAL_ERR)
+		{
+			lval* err = args[i];
+			for (int j = 0; j < n; ++j)
+			{
+				if (j != i)
+				{
+					lval_del(args[j]);
+				}
+			}
+			return err;
+		}
+	}
+
+	// Single Expression
+	if (n == 1)
+	{
+		return args[0];
+	}
+
+	// Ensure first element is a function
+	lval* f = args[0];
+	if (LVAL_TYPE(f) != LVAL_FUN)
+	{
+		lval* err = lval_err("S-Expression starts with incorrect type! Got %s, Expected %s.", 
+			ltype_name(LVAL_TYPE(f)), ltype_name(LVAL_FUN));
+		for (int i = 0; i < n; ++i)
+		{
+			lval_del(args[i]);
+		}
+		return err;
+	}
+
+	// Builtins taking an argument vector use the stack
+	if (f->call)
+	{
+		lcall_depth++;
+		lval* r = f->call(e, n - 1, args + 1);
+		lcall_depth--;
+		for (int i = 0; i < n; ++i)
+		{
+			lval_del(args[i]);
+		}
+		return r;
+	}
+
+	if (!f->builtin)
+	{
+		if (!f->code)
+		{
+			lvm_compile_fun(f);
+		}
+
+		// Simple calls bind straight into a new environment
+		if (f->code->arity == n - 1 && f->env->count == 0)
+		{
+			lenv* fe = lenv_frame(n - 1);
+			fe->par = e;
+			lenv_bind(fe, f->formals->cell, args + 1, n - 1);
+			for (int i = 1; i < n; ++i)
+			{
+				lval_del(args[i]);
+			}
+
+			lgc_push_root(&f);
+			lval* r = lvm_run(f->code, fe);
+			lgc_pop_root();
+			lenv_del(fe);
+			lval_del(f);
+			return r;
+		}
+	}
+
+	// Otherwise build the argument list, the stack may be reused by the call
+	lval* a = lval_sexpr();
+	for (int i = 1; i < n; ++i)
+	{
+		a = lval_add(a, args[i]);
+	}
+
+	if (!f->builtin)
+	{
+		f = lval_own(f);
+	}
+	lval* result = lval_call(e, f, a);
+	lval_del(f);
+	return result;
+}
+
+// Inline arithmetic on fixnums, NULL if the general call is needed
+lval* lvm_arith(int kind, int n)
+{
+	lval** args = &lvm.stack[lvm.sp - n];
+	lval* f = args[0];
+	if (LVAL_TYPE(f) != LVAL_FUN || f->builtin != lariths[kind].func)
+	{
+		return NULL;
+	}
+	for (int i = 1; i < n; ++i)
+	{
+		if (!LVAL_IS_FIX(args[i]))
+		{
+			return NULL;
+		}
+	}
+
+	long x = LVAL_LONG(args[1]);
+	long y = n > 2 ? LVAL_LONG(args[2]) : 0;
+	long r;
+	switch (kind)
+	{
+	case LARITH_ADD:
+	case LARITH_SUB:
+		// Fixnums are small enough that this cannot overflow
+		r = x;
+		for (int i = 2; i < n; ++i)
+		{
+			r = kind == LARITH_ADD ? r + LVAL_LONG(args[i]) : r - LVAL_LONG(args[i]);
+			if (r < LVAL_FIX_MIN || r > LVAL_FIX_MAX)
+			{
+				return NULL;
+			}
+		}
+		if (kind == LARITH_SUB && n == 2)
+		{
+			r = -x;
+		}
+		break;
+	case LARITH_MUL:
+		if (n != 3 || x > 0x7fffffffL || x < -0x7fffffffL || y > 0x7fffffffL || y < -0x7fffffffL)
+		{
+			return NULL;
+		}
+		r = x * y;
+		break;
+	case LARITH_GT: r = x > y; break;
+	case LARITH_LT: r = x < y; break;
+	case LARITH_GE: r = x >= y; break;
+	case LARITH_LE: r = x <= y; break;
+	case LARITH_EQ: r = x == y; break;
+	default: r = x != y; break;
+	}
+
+	lval_del(f);
+	lvm.sp -= n;
+	return lval_num(r);
+}
+
+// Make room on the stack for some code
+void lvm_reserve(lcode* c)
+{
+	if (lvm.sp + c->maxdepth > lvm.cap)
+	{
+		lvm.cap = max(lvm.cap * 2, lvm.sp + c->maxdepth);
+		lvm.stack = realloc(lvm.stack, sizeof(lval*) * lvm.cap);
+	}
+}
+
+// Compile an S-Expression evaluated in tail position on its own
+lcode* lvm_compile(lval* v)
+{
+	lcode* c = lcode_new();
+	if (LVAL_TYPE(v) == LVAL_SEXPR)
+	{
+		lcode_sexpr(c, v->cell, v->count, NULL, NULL, 1);
+	}
+	else
+	{
+		lcode_expr(c, v, NULL, NULL);
+	}
+	lcode_emit(c, OP_RETURN);
+	return c;
+}
+
+// A function entered by a tail call, 'env' is its own unless the call
+// bound the arguments into a fresh environment
+struct lframe {
+	lval* f;
+	lenv* env;
+};
+
+void lframe_del(struct lframe* fr)
+{
+	if (fr->env != fr->f->env)
+	{
+		lenv_del(fr->env);
+	}
+	lval_del(fr->f);
+}
+
+// Where a run keeps what it is using, chained to the run it is nested in
+struct lvm_roots {
+	lcode** c;
+	lcode** temp;
+	struct lframe** frames;
+	int* nframes;
+	lenv** e;
+	struct lvm_roots* up;
+};
+
+// The collector keeps the stack and what every run is using
+void lgc_mark_vm(void)
+{
+	for (int i = 0; i < lvm.sp; ++i)
+	{
+		lgc_mark(lvm.stack[i]);
+	}
+	for (struct lvm_roots* r = lvm.runs; r; r = r->up)
+	{
+		lgc_mark_code(*r->c);
+		lgc_mark_code(*r->temp);
+		lgc_mark_chain(*r->e);
+		for (int i = 0; i < *r->nframes; ++i)
+		{
+			lgc_mark((*r->frames)[i].f);
+			lgc_mark_chain((*r->frames)[i].env);
+		}
+	}
+}
+
+// Run compiled code in an environment
+// A call in tail position continues with the callee's code instead of
+// nesting, keeping the frames entered like lval_eval_sexpr does. Code
+// compiled for a tail 'if' or 'eval' is kept until it is left.
+lval* lvm_run(lcode* c, lenv* e)
+{
+	// The stack may move when nested code grows it, so index it afresh
+	lvm_reserve(c);
+
+	struct lframe* frames = NULL;
+	int nframes = 0;
+	int capframes = 0;
+	lcode* temp = NULL;
+	struct lvm_roots roots = { &c, &temp, &frames, &nframes, &e, lvm.runs };
+	lvm.runs = &roots;
+
+	// Calls are safe points, everything in use is rooted
+	lgc_safepoint(e);
+
+	lval* result = NULL;
+	int* ip = c->ops;
+	while (!result)
+	{
+		switch (*ip++)
+		{
+		case OP_CONST:
+			lvm.stack[lvm.sp++] = lval_copy(c->consts[*ip++]);
+			break;
+		case OP_EMPTY:
+			lvm.stack[lvm.sp++] = lval_sexpr();
+			break;
+		case OP_LOAD:
+			lvm.stack[lvm.sp++] = lvm_load(e, c->consts[ip[0]], &ip[1]);
+			ip += 2;
+			break;
+		case OP_LOCAL:
+		{
+			lval* k = c->consts[ip[0]];
+			int slot = ip[1];
+			ip += 2;
+			if (slot < e->count && e->oprs[slot] == k->opr)
+			{
+				lvm.stack[lvm.sp++] = lval_copy(e->vals[slot]);
+			}
+			else
+			{
+				lvm.stack[lvm.sp++] = lenv_get(e, k);
+			}
+			break;
+		}
+		case OP_SEXPR:
+		{
+			lval* r = lvm_sexpr(e, *ip++);
+			lvm.stack[lvm.sp++] = r;
+			break;
+		}
+		case OP_ARITH:
+		{
+			lval* r = lvm_arith(ip[0], ip[1]);
+			if (!r)
+			{
+				r = lvm_sexpr(e, ip[1]);
+			}
+			ip += 2;
+			lvm.stack[lvm.sp++] = r;
+			break;
+		}
+		case OP_IF:
+		{
+			// Inline the branches only while 'if' is the builtin
+			lval* h = lvm.stack[lvm.sp - 1];
+			if (LVAL_TYPE(h) == LVAL_FUN && h->builtin == builtin_if)
+			{
+				lvm.sp--;
+				lval_del(h);
+				ip++;
+			}
+			else
+			{
+				ip = c->ops + *ip;
+			}
+			break;
+		}
+		case OP_TEST:
+		{
+			// Same checks builtin_if makes on its condition
+			lval* x = lvm.stack[--lvm.sp];
+			if (LVAL_TYPE(x) == LVAL_ERR)
+			{
+				lvm.stack[lvm.sp++] = x;
+				ip = c->ops + ip[1];
+			}
+			else if (LVAL_TYPE(x) != LVAL_NUM)
+			{
+				lvm.stack[lvm.sp++] = lval_err(
+					"Function '%s' passed incorrect type for argument %d. Got %s, Expected %s.",
+					"if", 0, ltype_name(LVAL_TYPE(x)), ltype_name(LVAL_NUM));
+				lval_del(x);
+				ip = c->ops + ip[1];
+			}
+			else if (!LVAL_LONG(x))
+			{
+				lval_del(x);
+				ip = c->ops + ip[0];
+			}
+			else
+			{
+				lval_del(x);
+				ip += 2;
+			}
+			break;
+		}
+		case OP_JUMP:
+			ip = c->ops + *ip;
+			break;
+		case OP_RETURN:
+			result = lvm.stack[--lvm.sp];
+			break;
+		case OP_TAIL:
+		{
+			int n = *ip++;
+			lval** args = &lvm.stack[lvm.sp - n];
+			lval* f = args[0];
+
+			// Only function calls without errors go further
+			int call = LVAL_TYPE(f) == LVAL_FUN;
+			for (int i = 0; i < n && call; ++i)
+			{
+				call = LVAL_TYPE(args[i]) != LVAL_ERR;
+			}
+			if (!call || (f->builtin && f->builtin != builtin_if && f->builtin != builtin_eval))
+			{
+				result = lvm_sexpr(e, n);
+				break;
+			}
+
+			lvm.sp -= n;
+			lcode* next;
+			if (f->builtin)
+			{
+				// Continue with the expression 'if' or 'eval' would evaluate
+				lval* a = lval_sexpr();
+				for (int i = 1; i < n; ++i)
+				{
+					a = lval_add(a, args[i]);
+				}
+				lval* x = f->builtin == builtin_if ? lval_if_expr(a) : lval_eval_expr(a);
+				lval_del(f);
+				if (LVAL_TYPE(x) == LVAL_ERR)
+				{
+					result = x;
+					break;
+				}
+
+				next = lvm_compile(x);
+				lval_del(x);
+				lcode_del(temp);
+				temp = next;
+			}
+			else
+			{
+				if (!f->code)
+				{
+					lvm_compile_fun(f);
+				}
+
+				// Bind the arguments into the callee's frame
+				struct lframe fr;
+				if (f->code->arity == n - 1 && f->env->count == 0)
+				{
+					fr.f = f;
+					fr.env = lenv_frame(n - 1);
+					lenv_bind(fr.env, f->formals->cell, args + 1, n - 1);
+					for (int i = 1; i < n; ++i)
+					{
+						lval_del(args[i]);
+					}
+				}
+				else
+				{
+					lval* a = lval_sexpr();
+					for (int i = 1; i < n; ++i)
+					{
+						a = lval_add(a, args[i]);
+					}
+					fr.f = lval_own(f);
+					lval* r = lval_bind(e, fr.f, a);
+					if (r)
+					{
+						lval_del(fr.f);
+						result = r;
+						break;
+					}
+					fr.env = fr.f->env;
+				}
+
+				// Frames the callee hides can't be reached through it any more
+				for (int i = nframes - 1; i >= 0; --i)
+				{
+					if (lenv_covers(fr.env, frames[i].env))
+					{
+						if (i == nframes - 1)
+						{
+							e = frames[i].env->par;
+						}
+						else
+						{
+							frames[i + 1].env->par = frames[i].env->par;
+						}
+						lframe_del(&frames[i]);
+						memmove(&frames[i], &frames[i + 1], sizeof(struct lframe) * (nframes - i - 1));
+						nframes--;
+					}
+				}
+
+				fr.env->par = e;
+				if (nframes == capframes)
+				{
+					capframes = capframes ? capframes * 2 : 8;
+					frames = realloc(frames, sizeof(struct lframe) * capframes);
+				}
+				frames[nframes++] = fr;
+				e = fr.env;
+				next = f->code;
+
+				// The code left behind isn't needed any more
+				lcode_del(temp);
+				temp = NULL;
+			}
+
+			c = next;
+			ip = c->ops;
+			lvm_reserve(c);
+
+			// Between calls everything in use is rooted
+			lgc_safepoint(e);
+			break;
+		}
+		}
+	}
+
+	lvm.runs = roots.up;
+	lcode_del(temp);
+	for (int i = 0; i < nframes; ++i)
+	{
+		lframe_del(&frames[i]);
+	}
+	free(frames);
+	return result;
+}
+
+// Compile and run a single top-level form
+lval* lvm_eval(lenv* e, lval* v)
+{
+	lcode* c = lvm_compile(v);
+	lval_del(v);
+
+	lval* r = lvm_run(c, e);
+	lcode_del(c);
+	return r;
+}
+
+// Reader
+// Source text is read straight into lvals in a single pass. The syntax is
+// that of the grammar the interpreter used to be parsed with:
+//   number   : /-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?/
+//   operator : /[a-zA-Z0-9_+\-*\/\\=<>!%^&]+/
+//   string   : /"(\\.|[^"])*"/
+//   comment  : /;[^\r\n]*/
+// with lists in '(' and ')' or '{' and '}', and whitespace between.
+// Files are read in pieces, a top-level form at a time.
+#ifndef LREAD_CHUNK
+#define LREAD_CHUNK 65536
+#endif
+
+struct lreader {
+	char* name;
+	char* s;
+	char* end;
+
+	// Position of the line being read, for errors. Offsets count from the
+	// start of the input as the buffer is refilled.
+	int line;
+	long bol;
+
+	// A file being read into 'buf', which starts 'base' bytes into it
+	FILE* f;
+	char* buf;
+	size_t cap;
+	long base;
+	int error;
+
+	// Set when 's' is reading a cache of the forms instead
+	struct lcache_in* cache;
+};
+
+// An error at the current position of the reader
+lval* lread_err(struct lreader* r, char* msg)
+{
+	char at[32];
+	if (r->s < r->end)
+	{
+		snprintf(at, sizeof(at), "'%c'", *r->s);
+	}
+	else
+	{
+		snprintf(at, sizeof(at), "end of input");
+	}
+	return lval_err("%s:%d:%d: error: %s at %s", r->name, r->line,
+		(int)(r->base + (r->s - r->buf) - r->bol) + 1, msg, at);
+}
+
+// Move past a character, counting lines
+void lread_next(struct lreader* r)
+{
+	if (*r->s++ == '\n')
+	{
+		r->line++;
+		r->bol = r->base + (r->s - r->buf);
+	}
+}
+
+// Skip whitespace and comments
+void lread_space(struct lreader* r)
+{
+	while (r->s < r->end)
+	{
+		char c = *r->s;
+		if (c == ';')
+		{
+			while (r->s < r->end && *r->s != '\r' && *r->s != '\n')
+			{
+				r->s++;
+			}
+		}
+		else if (isspace((unsigned char)c))
+		{
+			lread_next(r);
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+int lread_digit(struct lreader* r, char* p)
+{
+	return p < r->end && isdigit((unsigned char)*p);
+}
+
+int lread_opr_char(char c)
+{
+	return isalnum((unsigned char)c) || (c && strchr("_+-*/\\=<>!%^&", c));
+}
+
+// Read a number from its text
+lval* lval_read_num(char* s)
+{
+	// Decimals and exponents make doubles
+	if (strpbrk(s, ".eE"))
+	{
+		return lval_dbl(strtod(s, NULL));
+	}
+
+	errno = 0;
+	long x = strtol(s, NULL, 10);
+	return errno != ERANGE ? lval_num(x) : lval_big_read(s);
+}
+
+lval* lread_num(struct lreader* r)
+{
+	char* start = r->s;
+	char* p = r->s + (*r->s == '-');
+	while (lread_digit(r, p))
+	{
+		p++;
+	}
+	if (p < r->end && *p == '.' && lread_digit(r, p + 1))
+	{
+		for (p++; lread_digit(r, p); p++);
+	}
+	if (p < r->end && (*p == 'e' || *p == 'E'))
+	{
+		char* q = p + 1;
+		q += q < r->end && (*q == '-' || *q == '+');
+		if (lread_digit(r, q))
+		{
+			for (p = q; lread_digit(r, p); p++);
+		}
+	}
+	r->s = p;
+
+	// The text is copied out as it needn't be terminated here
+	size_t n = p - start;
+	char buf[64];
+	char* text = n < sizeof(buf) ? buf : malloc(n + 1);
+	memcpy(text, start, n);
+	text[n] = '\0';
+	lval* x = lval_read_num(text);
+	if (text != buf)
+	{
+		free(text);
+	}
+	return x;
+}
+
+// Operators are interned straight from the source
+lval* lread_opr(struct lreader* r)
+{
+	char* start = r->s;
+	while (r->s < r->end && lread_opr_char(*r->s))
+	{
+		r->s++;
+	}
+	return lval_opr_n(start, r->s - start);
+}
+
+// Read a string, unescaping it as it goes
+lval* lread_str(struct lreader* r)
+{
+	char* escapes = "abfnrtv\\'\"0";
+	char* chars = "\a\b\f\n\r\t\v\\'\"";
+
+	// Find the closing quote first, the string is no longer than that
+	char* p = r->s + 1;
+	while (p < r->end && *p != '"')
+	{
+		p += *p == '\\' && p + 1 < r->end ? 2 : 1;
+	}
+	if (p >= r->end)
+	{
+		while (r->s < r->end)
+		{
+			lread_next(r);
+		}
+		return lread_err(r, "expected '\"'");
+	}
+
+	// Unescaped straight into the string's own storage
+	char* buf = malloc(p - r->s);
+	size_t n = 0;
+	lread_next(r);
+	while (r->s < p)
+	{
+		char c = *r->s;
+		lread_next(r);
+		if (c == '\\')
+		{
+			char* k = strchr(escapes, *r->s);
+			if (k && *k)
+			{
+				// '\0' would end the string so is left out
+				if (*k != '0')
+				{
+					buf[n++] = chars[k - escapes];
+				}
+				lread_next(r);
+				continue;
+			}
+		}
+		buf[n++] = c;
+	}
+	lread_next(r);
+
+	buf[n] = '\0';
+	lval* x = lval_alloc(LVAL_STR);
+	x->str = buf;
+	return x;
+}
+
+lval* lread_expr(struct lreader* r);
+
+// Read the expressions of a list up to its closing bracket
+lval* lread_list(struct lreader* r, lval* x, char close)
+{
+	lread_next(r);
+	while (1)
+	{
+		lread_space(r);
+		if (r->s < r->end && *r->s == close)
+		{
+			lread_next(r);
+			return x;
+		}
+		if (r->s == r->end || *r->s == ')' || *r->s == '}')
+		{
+			lval_del(x);
+			return lread_err(r, close == ')' ? "expected ')'" : "expected '}'");
+		}
+
+		lval* y = lread_expr(r);
+		if (LVAL_TYPE(y) == LVAL_ERR)
+		{
+			lval_del(x);
+			return y;
+		}
+		x = lval_add(x, y);
+	}
+}
+
+// Read one expression, whitespace before it has been skipped
+lval* lread_expr(struct lreader* r)
+{
+	char c = *r->s;
+	if (isdigit((unsigned char)c) || (c == '-' && lread_digit(r, r->s + 1)))
+	{
+		return lread_num(r);
+	}
+	if (lread_opr_char(c))
+	{
+		return lread_opr(r);
+	}
+
+	switch (c)
+	{
+	case '"':
+		return lread_str(r);
+	case '(':
+		return lread_list(r, lval_sexpr(), ')');
+	case '{':
+		return lread_list(r, lval_qexpr(), '}');
+	default:
+		return lread_err(r, "unexpected character");
+	}
+}
+
+// Find the end of the top-level form starting at or after p, NULL if the
+// input runs out first. It only needs to be found, not checked, so any
+// bracket closes a list and anything else ends an atom.
+char* lread_scan(char* p, char* end)
+{
+	int depth = 0;
+	while (p < end)
+	{
+		char c = *p;
+		if (c == ';')
+		{
+			while (p < end && *p != '\r' && *p != '\n')
+			{
+				p++;
+			}
+			continue;
+		}
+		if (isspace((unsigned char)c))
+		{
+			p++;
+			continue;
+		}
+
+		if (c == '"')
+		{
+			for (p++; p < end && *p != '"'; p += *p == '\\' ? 2 : 1);
+			if (p >= end)
+			{
+				return NULL;
+			}
+			p++;
+		}
+		else if (c == '(' || c == '{')
+		{
+			depth++;
+			p++;
+		}
+		else if (c == ')' || c == '}')
+		{
+			depth--;
+			p++;
+		}
+		else
+		{
+			while (p < end && !isspace((unsigned char)*p) && !strchr("(){}\";", *p))
+			{
+				p++;
+			}
+			if (p == end)
+			{
+				return NULL;
+			}
+		}
+
+		if (depth <= 0)
+		{
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Read from the file until the next top-level form is all in the buffer
+// or the file ends, so the reader never runs out part way through one
+void lread_fill(struct lreader* r)
+{
+	while (r->f && !lread_scan(r->s, r->end))
+	{
+		// Keep what is left at the front, with at least as much room again
+		// so a long form is only scanned a few times
+		size_t left = r->end - r->s;
+		size_t want = left + max(left, LREAD_CHUNK);
+		r->base += r->s - r->buf;
+		if (left)
+		{
+			memmove(r->buf, r->s, left);
+		}
+		if (r->cap < want)
+		{
+			r->buf = realloc(r->buf, want);
+			r->cap = want;
+		}
+		r->s = r->buf;
+		r->end = r->buf + left;
+
+		size_t k = fread(r->end, 1, r->cap - left, r->f);
+		r->end += k;
+		if (k == 0)
+		{
+			r->error = ferror(r->f);
+			fclose(r->f);
+			r->f = NULL;
+		}
+	}
+}
+
+// Cached forms
+// Loading a file that parsed cleanly writes what was read to a '.lspc'
+// file beside it. The cache starts with the length and hash of the source
+// it came from, the interpreter version and a hash of the forms, and
+// while they still match the forms are taken from the mapped cache
+// instead of parsing again.
+// Each form is a tag character followed by its contents, counts and
+// integers as variable length numbers and the rest in native byte order
+// (a cache is never shared between machines):
+//   'i' integer   'b' sign, limb count and limbs   'd' double
+//   'o' length and characters of an operator not seen before in the file
+//   'O' index of an operator seen before, in order of first appearance
+//   's' length and characters   '(' and '{' count and items
+// Images (below) use the same encoding and hold other values as well:
+//   'e' length and characters of an error   'v' length and numbers
+//   'B' a builtin, by its operator in a fresh environment
+//   'f' a function's formals, body, count and operators and values bound
+#define LCACHE_MAGIC "LSPC0001"
+
+struct lcache {
+	int enabled;
+};
+
+struct lcache lcache = { 1 };
+
+struct lcache_head {
+	char magic[8];
+	char version[16];
+	uint64_t size;
+	uint64_t hash;
+
+	// Hash of everything after the header
+	uint64_t check;
+};
+
+// A growing buffer forms are written to, with the index of each operator
+// written so far by its interned name. Images also need the builtins.
+struct lcache_buf {
+	char* data;
+	size_t len;
+	size_t cap;
+
+	char** syms;
+	int* index;
+	int nsyms;
+	int symcap;
+
+	lenv* builtins;
+};
+
+// An operator of a cache being read
+struct lcache_sym {
+	char* opr;
+	unsigned long hash;
+};
+
+// A cache being read, with the operators it has brought in so far. Only
+// images have builtins to look theirs up in, and only they may hold
+// values other than forms.
+struct lcache_in {
+	char* end;
+	struct lcache_sym* syms;
+	int nsyms;
+	lenv* builtins;
+};
+
+// FNV-1a over the whole source, or the forms of a cache
+uint64_t lcache_hash(char* s, size_t n)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < n; ++i)
+	{
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// The cache for source 'name', ".lspi" becomes ".lspc" or it is added
+char* lcache_path(char* name)
+{
+	size_t n = strlen(name);
+	if (n >= 5 && strcmp(name + n - 5, ".lspi") == 0)
+	{
+		n -= 5;
+	}
+	char* path = malloc(n + 6);
+	memcpy(path, name, n);
+	strcpy_s(path + n, 6, ".lspc");
+	return path;
+}
+
+void lcache_put(struct lcache_buf* b, void* p, size_t n)
+{
+	if (b->len + n > b->cap)
+	{
+		b->cap = max(b->cap * 2, b->len + n);
+		b->data = realloc(b->data, b->cap);
+	}
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+}
+
+// Seven bits at a time, least significant first
+void lcache_put_uint(struct lcache_buf* b, uint64_t x)
+{
+	unsigned char bytes[10];
+	int n = 0;
+	while (x >= 0x80)
+	{
+		bytes[n++] = (unsigned char)(x | 0x80);
+		x >>= 7;
+	}
+	bytes[n++] = (unsigned char)x;
+	lcache_put(b, bytes, n);
+}
+
+void lcache_put_tag(struct lcache_buf* b, char tag, uint64_t x)
+{
+	lcache_put(b, &tag, 1);
+	lcache_put_uint(b, x);
+}
+
+// Read a number written by lcache_put_uint, returning 0 if it runs past
+// the end or is too long
+int lcache_get_uint(char** p, char* end, uint64_t* x)
+{
+	*x = 0;
+	for (int shift = 0; *p < end && shift < 64; shift += 7)
+	{
+		unsigned char c = *(*p)++;
+		*x |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Write an operator by its index if it has been written before
+void lcache_put_opr(struct lcache_buf* b, char* opr, unsigned long hash)
+{
+	if (b->nsyms * 2 >= b->symcap)
+	{
+		// Rehash into a table twice the size
+		int cap = b->symcap ? b->symcap * 2 : 64;
+		char** syms = calloc(cap, sizeof(char*));
+		int* index = malloc(sizeof(int) * cap);
+		for (int i = 0; i < b->symcap; ++i)
+		{
+			if (b->syms[i])
+			{
+				int j = (int)(lhash(b->syms[i], strlen(b->syms[i])) & (cap - 1));
+				while (syms[j])
+				{
+					j = (j + 1) & (cap - 1);
+				}
+				syms[j] = b->syms[i];
+				index[j] = b->index[i];
+			}
+		}
+		free(b->syms);
+		free(b->index);
+		b->syms = syms;
+		b->index = index;
+		b->symcap = cap;
+	}
+
+	// Interned names compare by pointer
+	int j = (int)(hash & (b->symcap - 1));
+	for (; b->syms[j]; j = (j + 1) & (b->symcap - 1))
+	{
+		if (b->syms[j] == opr)
+		{
+			lcache_put_tag(b, 'O', b->index[j]);
+			return;
+		}
+	}
+	b->syms[j] = opr;
+	b->index[j] = b->nsyms++;
+
+	size_t n = strlen(opr);
+	lcache_put_tag(b, 'o', n);
+	lcache_put(b, opr, n);
+}
+
+void lcache_write(struct lcache_buf* b, lval* v);
+
+// Write a builtin by the operator it is bound to in a fresh environment,
+// or a function by what is needed to make it again
+void lcache_put_fun(struct lcache_buf* b, lval* v)
+{
+	if (v->builtin)
+	{
+		lenv* e = b->builtins;
+		for (int i = 0; i < e->count; ++i)
+		{
+			if (e->vals[i]->builtin == v->builtin)
+			{
+				lcache_put(b, "B", 1);
+				lcache_put_opr(b, e->oprs[i], e->hashes[i]);
+				return;
+			}
+		}
+		lcache_put_tag(b, 'e', strlen("Unknown builtin"));
+		lcache_put(b, "Unknown builtin", strlen("Unknown builtin"));
+		return;
+	}
+
+	lcache_put(b, "f", 1);
+	lcache_write(b, v->formals);
+	lcache_write(b, v->body);
+	lcache_put_uint(b, v->env->count);
+	for (int i = 0; i < v->env->count; ++i)
+	{
+		lcache_put_opr(b, v->env->oprs[i], v->env->hashes[i]);
+		lcache_write(b, v->env->vals[i]);
+	}
+}
+
+// Append a value. Forms as read only have numbers, operators, strings
+// and lists, anything else comes from an image.
+void lcache_write(struct lcache_buf* b, lval* v)
+{
+	switch (LVAL_TYPE(v))
+	{
+	case LVAL_NUM:
+		if (LVAL_IS_BIG(v))
+		{
+			char neg = (char)v->neg;
+			lcache_put(b, "b", 1);
+			lcache_put(b, &neg, 1);
+			lcache_put_uint(b, v->nlimbs);
+			lcache_put(b, v->limbs, sizeof(uint32_t) * v->nlimbs);
+		}
+		else
+		{
+			// Zigzag so small negative numbers stay short too
+			long x = LVAL_LONG(v);
+			lcache_put_tag(b, 'i', x < 0 ? ~((uint64_t)x << 1) : (uint64_t)x << 1);
+		}
+		break;
+	case LVAL_DBL:
+		lcache_put(b, "d", 1);
+		lcache_put(b, &v->dbl, sizeof(v->dbl));
+		break;
+	case LVAL_OPR:
+		lcache_put_opr(b, v->opr, v->hash);
+		break;
+	case LVAL_STR:
+		lcache_put_tag(b, 's', strlen(v->str));
+		lcache_put(b, v->str, strlen(v->str));
+		break;
+	case LVAL_ERR:
+		lcache_put_tag(b, 'e', strlen(v->err));
+		lcache_put(b, v->err, strlen(v->err));
+		break;
+	case LVAL_VEC:
+		lcache_put_tag(b, 'v', v->len);
+		lcache_put(b, v->data, sizeof(int64_t) * v->len);
+		break;
+	case LVAL_FUN:
+		lcache_put_fun(b, v);
+		break;
+	default:
+		lcache_put_tag(b, LVAL_TYPE(v) == LVAL_SEXPR ? '(' : '{', v->count);
+		for (int i = 0; i < v->count; ++i)
+		{
+			lcache_write(b, v->cell[i]);
+		}
+		break;
+	}
+}
+
+char* lcache_skip(char* p, struct lcache_in* in);
+
+// Step over a list of operators, such as a function's formals
+char* lcache_skip_oprs(char* p, struct lcache_in* in)
+{
+	uint64_t n;
+	if (p >= in->end || (*p != '{' && *p != '(') || (p++, !lcache_get_uint(&p, in->end, &n)))
+	{
+		return NULL;
+	}
+	for (uint64_t i = 0; i < n && p; ++i)
+	{
+		p = p < in->end && (*p == 'o' || *p == 'O') ? lcache_skip(p, in) : NULL;
+	}
+	return p;
+}
+
+// Step over the value at p counting the operators it brings in, or
+// return NULL if it runs past the end, refers to an operator not brought
+// in yet or has a tag it can't. The whole cache is checked like this
+// before any of it is used, so a damaged one is just rebuilt.
+char* lcache_skip(char* p, struct lcache_in* in)
+{
+	char* end = in->end;
+	if (p >= end)
+	{
+		return NULL;
+	}
+	char tag = *p++;
+	if (tag == 'd')
+	{
+		return (size_t)(end - p) >= sizeof(double) ? p + sizeof(double) : NULL;
+	}
+	if (tag == 'b' && p++ == end)
+	{
+		return NULL;
+	}
+
+	// Values that aren't forms, only images have them
+	if (strchr("evBf", tag))
+	{
+		if (!in->builtins)
+		{
+			return NULL;
+		}
+		if (tag == 'B')
+		{
+			return p < end && (*p == 'o' || *p == 'O') ? lcache_skip(p, in) : NULL;
+		}
+		if (tag == 'f')
+		{
+			// The body is only ever a list
+			p = lcache_skip_oprs(p, in);
+			p = p && p < end && (*p == '{' || *p == '(') ? lcache_skip(p, in) : NULL;
+		}
+	}
+
+	uint64_t n;
+	if (!p || !lcache_get_uint(&p, end, &n))
+	{
+		return NULL;
+	}
+
+	switch (tag)
+	{
+	case 'i':
+		return p;
+	case 'b':
+		return n <= INT_MAX && (uint64_t)(end - p) / sizeof(uint32_t) >= n ? p + n * sizeof(uint32_t) : NULL;
+	case 'o':
+		if (n == 0 || (uint64_t)(end - p) < n)
+		{
+			return NULL;
+		}
+		in->nsyms++;
+		return p + n;
+	case 'O':
+		return n < (uint64_t)in->nsyms ? p : NULL;
+	case 's':
+	case 'e':
+		return (uint64_t)(end - p) >= n ? p + n : NULL;
+	case 'v':
+		return (uint64_t)(end - p) / sizeof(int64_t) >= n ? p + n * sizeof(int64_t) : NULL;
+	case 'f':
+		// Bound operators and their values
+		for (uint64_t i = 0; i < n && p; ++i)
+		{
+			p = p < end && (*p == 'o' || *p == 'O') ? lcache_skip(p, in) : NULL;
+			p = p ? lcache_skip(p, in) : NULL;
+		}
+		return p;
+	case '(':
+	case '{':
+		if (n > INT_MAX)
+		{
+			return NULL;
+		}
+		for (uint64_t i = 0; i < n && p; ++i)
+		{
+			p = lcache_skip(p, in);
+		}
+		return p;
+	default:
+		return NULL;
+	}
+}
+
+// Read back the value at *p, which has been checked already. Operators
+// are interned straight from the cache the first time they appear.
+lval* lcache_read(char** p, struct lcache_in* in)
+{
+	char tag = *(*p)++;
+	if (tag == 'd')
+	{
+		double x;
+		memcpy(&x, *p, sizeof(x));
+		*p += sizeof(x);
+		return lval_dbl(x);
+	}
+	if (tag == 'B')
+	{
+		lval* k = lcache_read(p, in);
+		lval* v = lenv_get(in->builtins, k);
+		lval_del(k);
+		return v;
+	}
+
+	lval* v = NULL;
+	if (tag == 'f')
+	{
+		lval* formals = lcache_read(p, in);
+		v = lval_lambda(formals, lcache_read(p, in));
+	}
+	int neg = tag == 'b' ? *(*p)++ : 0;
+
+	uint64_t n;
+	lcache_get_uint(p, in->end, &n);
+
+	switch (tag)
+	{
+	case 'i':
+		return lval_num(n & 1 ? (long)~(n >> 1) : (long)(n >> 1));
+	case 'b':
+	{
+		lbig x;
+		x.neg = neg;
+		x.n = (int)n;
+		x.d = malloc(sizeof(uint32_t) * (n + 1));
+		memcpy(x.d, *p, sizeof(uint32_t) * n);
+		*p += sizeof(uint32_t) * n;
+		return lval_big(x);
+	}
+	case 'o':
+		v = lval_opr_n(*p, n);
+		*p += n;
+		in->syms[in->nsyms].opr = v->opr;
+		in->syms[in->nsyms].hash = v->hash;
+		in->nsyms++;
+		return v;
+	case 'O':
+		v = lval_alloc(LVAL_OPR);
+		v->opr = in->syms[n].opr;
+		v->hash = in->syms[n].hash;
+		v->slot = -1;
+		return v;
+	case 's':
+		v = lval_alloc(LVAL_STR);
+		v->str = malloc(n + 1);
+		memcpy(v->str, *p, n);
+		v->str[n] = '\0';
+		*p += n;
+		return v;
+	case 'e':
+		v = lval_alloc(LVAL_ERR);
+		v->err = malloc(n + 1);
+		memcpy(v->err, *p, n);
+		v->err[n] = '\0';
+		*p += n;
+		return v;
+	case 'v':
+		v = lval_vec((long)n);
+		if (LVAL_TYPE(v) == LVAL_VEC)
+		{
+			memcpy(v->data, *p, sizeof(int64_t) * n);
+		}
+		*p += sizeof(int64_t) * n;
+		return v;
+	case 'f':
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			lval* k = lcache_read(p, in);
+			lval* x = lcache_read(p, in);
+			lenv_put(v->env, k, x);
+			lval_del(k);
+			lval_del(x);
+		}
+		return v;
+	default:
+		v = tag == '(' ? lval_sexpr() : lval_qexpr();
+		if (n)
+		{
+			v->cell = lmem_alloc(LMEM_CELL, sizeof(lval*) * n);
+			v->cap = (int)n;
+		}
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			v->cell[v->count++] = lcache_read(p, in);
+		}
+		return v;
+	}
 }
 
-
-// Define functions(builtin)
-lval* builtin_var(lenv* e, lval* a, char* func)
+#ifdef LREAD_MMAP
+// Map the regular file 'name' read only, setting n to its length, or
+// return NULL so it is streamed instead
+char* lread_map(char* name, size_t* n)
 {
-	LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
-
-	// First argument is operator list
-	lval* oprs = a->cell[0];
-
-	// Ensure all elements of the first list are sybmols
-	for (int i = 0; i < oprs->count; ++i)
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
 	{
-		LASSERT(a, (oprs->cell[i]->type == LVAL_OPR), 
-			"Function 'def' cannot define non-operator! Got %s, Expected %s", 
-			ltype_name(oprs->cell[i]->type), ltype_name(LVAL_OPR));
+		return NULL;
 	}
 
-	// Check correct number of symbols and values
-	LASSERT(a, (oprs->count == a->count - 1), 
-		"Function 'def' passed too many arguments for operators! Got %d, Expected %d.", 
-		oprs->count, a->count - 1);
-		
-	// Assign copies of values to operators
-	for (int i = 0; i < oprs->count; ++i)
+	struct stat st;
+	char* map = NULL;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
 	{
-		if (strcmp(func, "def") == 0)
-		{
-			lenv_def(e, oprs->cell[i], a->cell[i + 1]);
-		}
-
-		if (strcmp(func, "=") == 0)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
 		{
-			lenv_put(e, oprs->cell[i], a->cell[i + 1]);
+			map = NULL;
 		}
+		*n = st.st_size;
 	}
-
-	lval_del(a);
-	return lval_sexpr();
+	close(fd);
+	return map;
 }
 
-// Print the lines provided from a file
-lval* builtin_print(lenv* e, lval* a)
+// Map the cache at 'path' if it is for the source 'size' bytes long with
+// the given hash, setting n to its length and nsyms to the number of
+// operators in it. Returns NULL if it is missing, stale or damaged, down
+// to a single changed byte.
+char* lcache_map(char* path, uint64_t size, uint64_t hash, size_t* n, int* nsyms)
 {
-	// Print each argument followed by a space
-	for (int i = 0; i < a->count; ++i)
+	char* map = lread_map(path, n);
+	if (!map)
 	{
-		lval_print(a->cell[i]);
-		putchar(' ');
+		return NULL;
 	}
-	
-	// Print a newline and delete arguments
-	putchar('\n');
-	lval_del(a);	
 
-	return lval_sexpr();
+	struct lcache_head head;
+	int ok = *n >= sizeof(head);
+	if (ok)
+	{
+		memcpy(&head, map, sizeof(head));
+		ok = memcmp(head.magic, LCACHE_MAGIC, sizeof(head.magic)) == 0
+			&& strncmp(head.version, LISPI_VERSION, sizeof(head.version)) == 0
+			&& head.size == size && head.hash == hash
+			&& head.check == lcache_hash(map + sizeof(head), *n - sizeof(head));
+	}
+	struct lcache_in in = { map + *n, NULL, 0, NULL };
+	for (char* p = map + sizeof(head); ok && p < in.end; )
+	{
+		p = lcache_skip(p, &in);
+		ok = p != NULL;
+	}
+	*nsyms = in.nsyms;
+	if (!ok)
+	{
+		munmap(map, *n);
+		return NULL;
+	}
+	return map;
 }
 
-// Print an error in a string provided by the user
-lval* builtin_error(lenv* e, lval* a)
+// Write the forms in 'b' as the cache at 'path'. It goes to a temporary
+// file first so a cache is never seen half written. Failing to write it
+// (say the directory is read only) only means the next load parses again.
+void lcache_save(char* path, uint64_t size, uint64_t hash, struct lcache_buf* b)
 {
-	LASSERT_NUM("error", a, 1);
-	LASSERT_TYPE("error", a, 0, LVAL_STR);
-
-	// Construct error from first argument
-	lval* err = lval_err(a->cell[0]->str);
-
-	// Delete arguments and return
-	lval_del(a);
-	return err;
+	struct lcache_head head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, LCACHE_MAGIC, sizeof(head.magic));
+	strncpy(head.version, LISPI_VERSION, sizeof(head.version) - 1);
+	head.size = size;
+	head.hash = hash;
+	head.check = lcache_hash(b->data, b->len);
+
+	char* tmp = malloc(strlen(path) + 32);
+	sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+	FILE* f = fopen(tmp, "wb");
+	if (f)
+	{
+		int ok = fwrite(&head, sizeof(head), 1, f) == 1
+			&& (b->len == 0 || fwrite(b->data, 1, b->len, f) == b->len);
+		ok = fclose(f) == 0 && ok;
+		if (!ok || rename(tmp, path) != 0)
+		{
+			remove(tmp);
+		}
+	}
+	free(tmp);
 }
+#endif
 
-// Call user defined functions
-lval* lval_call(lenv* e, lval* f, lval* a)
+// Read the next top-level form, NULL once the input is used up
+lval* lread_form(struct lreader* r)
 {
-	// If builtin then simply call that function
-	if (f->builtin)
+	// Forms from a cache were checked when it was mapped
+	if (r->cache)
 	{
-		return f->builtin(e, a);
+		return r->s < r->end ? lcache_read(&r->s, r->cache) : NULL;
 	}
 
-	// Save the argument counts
-	int given = a->count;
-	int total = f->formals->count;
+	lread_fill(r);
+	lread_space(r);
+	if (r->s == r->end)
+	{
+		return NULL;
+	}
+	return lread_expr(r);
+}
 
-	// While there are arguments to be processed
-	while (a->count)
+// Read all of the source 's' of length n as one S-Expression, or return
+// an error giving the line and column the reader stopped at
+lval* lval_read(char* name, char* s, size_t n)
+{
+	struct lreader r = { name, s, s + n, 1, 0, NULL, s, 0, 0, 0, NULL };
+	lval* x = lval_sexpr();
+	lval* y;
+	while ((y = lread_form(&r)))
 	{
-		// If we ran out of formal arguments to bind
-		if (f->formals->count == 0)
+		if (LVAL_TYPE(y) == LVAL_ERR)
 		{
-			lval_del(a); 
-			return lval_err("Function passed too many arguments! Got %d, Expected %d.", given, total);
+			lval_del(x);
+			return y;
 		}
-		
-		// Pop the first operator from the formals
-		lval* opr = lval_pop(f->formals, 0);
+		x = lval_add(x, y);
+	}
+	return x;
+}
 
-		// Special case to deal with '&'
-		if (strcmp(opr->opr, "&") == 0)
-		{
-			// Ensure '&' is followed by another operator
-			if (f->formals->count != 1)
-			{
-				lval_del(a);
-				return lval_err("Function formal invalid! Operator '&' not followed by a single operator.");
-			}
 
-			// Next formal should be bound to remaining arguments
-			lval* nopr = lval_pop(f->formals, 0);
-			lenv_put(f->env, nopr, builtin_list(e, a));
-			lval_del(opr);
-			lval_del(nopr);
-			break;
-		}
+// Loads a file through a string provided. Each form is evaluated as soon
+// as it has been read, before the rest of the file.
+lval* builtin_load(lenv* e, lval* a)
+{
+	LASSERT_NUM("load", a, 1);
+	LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-		// Pop the next argument from the list
-		lval* val = lval_pop(a, 0);
+	struct lreader r = { a->cell[0]->str, NULL, NULL, 1, 0, NULL, NULL, 0, 0, 0, NULL };
+	char* map = NULL;
 
-		// Bind a copy into the function's environment
-		lenv_put(f->env, opr, val);
+	// Where the forms read are to be cached, if anywhere
+	char* path = NULL;
+	struct lcache_buf out = { NULL, 0, 0, NULL, NULL, 0, 0, NULL };
+	struct lcache_in in = { NULL, NULL, 0, NULL };
 
-		// Delete operator and value
-		lval_del(opr);
-		lval_del(val);
+#ifdef LREAD_MMAP
+	// Parse straight from the mapped file when it can be mapped
+	size_t n = 0;
+	uint64_t hash = 0;
+	map = lread_map(a->cell[0]->str, &n);
+	if (map && lcache.enabled)
+	{
+		// Or skip parsing altogether when its cache is up to date
+		hash = lcache_hash(map, n);
+		path = lcache_path(a->cell[0]->str);
+		size_t cn = 0;
+		int nsyms = 0;
+		char* cache = lcache_map(path, n, hash, &cn, &nsyms);
+		if (cache)
+		{
+			munmap(map, n);
+			map = cache;
+			n = cn;
+			in.end = map + n;
+			in.syms = malloc(sizeof(struct lcache_sym) * (nsyms + 1));
+			r.cache = &in;
+			free(path);
+			path = NULL;
+		}
+	}
+	if (map)
+	{
+		r.buf = map;
+		r.s = map + (r.cache ? sizeof(struct lcache_head) : 0);
+		r.end = map + n;
+	}
+#endif
 
+	// Otherwise open the file given by string and read it in chunks
+	if (!map)
+	{
+		r.f = fopen(a->cell[0]->str, "rb");
+		LASSERT(a, r.f, "Could not load Library %s: %s", a->cell[0]->str, strerror(errno));
 	}
 
-	// Argument list is now bound so clean it
-	lval_del(a);
+	// The file name is needed until the end
+	lgc_push_root(&a);
 
-	// If '&' remain in formal list bind to empty list
-	if (f->formals->count > 0 && strcmp(f->formals->cell[0]->opr, "&") == 0)
+	lval* err = NULL;
+	while (!err)
 	{
-		// Check to ensure that '&' is not passed invalidly
-		if (f->formals->count != 2)
+		lval* form = lread_form(&r);
+		if (!form)
 		{
-			return lval_err("Function format invalid! Symbol '&' no followed by a single symbol.");
+			break;
+		}
+		if (LVAL_TYPE(form) == LVAL_ERR)
+		{
+			err = lval_err("Could not load Library %s", form->err);
+			lval_del(form);
+			break;
+		}
+		if (path)
+		{
+			lcache_write(&out, form);
 		}
 
-		// Pop and delete '&' symbol
-		lval_del(lval_pop(f->formals, 0));
+		lnursery_begin();
+		lval* x = lvm.enabled ? lvm_eval(e, form) : lval_eval(e, form);
 
-		// Pop next operator and create empty list
-		lval* opr = lval_pop(f->formals, 0);
-		lval* val = lval_qexpr();
+		// If evaluation leads to error print it
+		if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			lval_println(x);
+		}
+		lval_del(x);
 
-		// Bind to environment and delete
-		lenv_put(f->env, opr, val);
-		lval_del(opr);
-		lval_del(val);
+		lnursery_end();
+		lgc_safepoint(e);
 	}
 
-	// If all formals have been bound evaluate
-	if (f->formals->count == 0)
+	if (r.error && !err)
 	{
-		// Set environment parent to evaluation environment
-		f->env->par = e;
-
-		// Evaluate and return
-		return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+		err = lval_err("Could not load Library %s: %s", a->cell[0]->str, strerror(r.error));
 	}
-	else
+	if (r.f)
 	{
-		// Otherwise return partially evaluated function
-		return lval_copy(f);
+		fclose(r.f);
 	}
-
-}
-
-// lval* evaluator
-lval* lval_eval(lenv* e, lval* v)
-{
-	if (v->type == LVAL_OPR)
+#ifdef LREAD_MMAP
+	// Only a file that read without errors is cached
+	if (path && !err)
 	{
-		lval* x = lenv_get(e, v);
-		lval_del(v);
-		return x;
+		lcache_save(path, n, hash, &out);
 	}
-
-	if (v->type == LVAL_SEXPR)
+	if (map)
 	{
-		return lval_eval_sexpr(e, v);
+		munmap(map, n);
+		r.buf = NULL;
 	}
-	
-	return v;
+#endif
+	free(r.buf);
+	free(in.syms);
+	free(path);
+	free(out.data);
+	free(out.syms);
+	free(out.index);
+
+	// Delete arguments and return the error or an empty list
+	lgc_pop_root();
+	lval_del(a);
+	return err ? err : lval_sexpr();
 }
 
-// Reads a string and returns it unescaped
-lval* lval_read_str(mpc_ast_t* t)
-{
-	// Cut off the final quote characters
-	t->contents[strlen(t->contents) - 1] = '\0';
-	
-	// Copy the string missing out the first quote character
-	char* unescaped = malloc(strlen(t->contents + 1) + 1);
-	strcpy_s(unescaped, (strlen(t->contents + 1) + 1), (t->contents + 1));
-	
-	// Pass through the unescape function
-	unescaped = mpcf_unescape(unescaped);
-	
-	// Construct a new lval using the string
-	lval* str = lval_str(unescaped);
-	
-	// Free the string and retuen
-	free(unescaped);
-	return str;
-}
 
+// Images
+// An image holds every binding of the global environment, in the
+// encoding of the cache after a header and the number of bindings. The
+// header has a hash of the rest, so a damaged image is refused whole.
+// Builtins are saved by name and functions by their formals, body and
+// any arguments bound already, so starting from one evaluates nothing.
+// Compiled code isn't saved, the VM compiles functions again as needed.
+#define LIMAGE_MAGIC "LIMG0001"
 
-// read a number from the AST output to lval*
-lval* lval_read_num(mpc_ast_t* t)
-{
-	errno = 0;
-	long x = strtol(t->contents, NULL, 10);
-	return errno != ERANGE ? lval_num(x) : lval_err("Invalid number.");
-}
+struct limage_head {
+	char magic[8];
+	char version[16];
+	uint64_t check;
+};
 
-// read from the AST output to lval*
-lval* lval_read(mpc_ast_t* t)
+// Write the bindings of e to the image at 'path'
+lval* lenv_dump_image(lenv* e, char* path)
 {
-	// If operators or numbers return conversion to that type
-	if (strstr(t->tag, "number"))
+	struct lcache_buf b = { NULL, 0, 0, NULL, NULL, 0, 0, lenv_new() };
+	lenv_add_builtins(b.builtins);
+	lcache_put_uint(&b, e->count);
+	for (int i = 0; i < e->count; ++i)
+	{
+		lcache_put_opr(&b, e->oprs[i], e->hashes[i]);
+		lcache_write(&b, e->vals[i]);
+	}
+
+	struct limage_head head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, LIMAGE_MAGIC, sizeof(head.magic));
+	strncpy(head.version, LISPI_VERSION, sizeof(head.version) - 1);
+	head.check = lcache_hash(b.data, b.len);
+
+	lval* err = NULL;
+	FILE* f = fopen(path, "wb");
+	if (!f || fwrite(&head, sizeof(head), 1, f) != 1 || fwrite(b.data, 1, b.len, f) != b.len)
 	{
-		return lval_read_num(t);
+		err = lval_err("Could not write image %s: %s", path, strerror(errno));
 	}
-	if (strstr(t->tag, "string"))
+	if (f && fclose(f) != 0 && !err)
 	{
-		return lval_read_str(t);
+		err = lval_err("Could not write image %s: %s", path, strerror(errno));
 	}
-	if (strstr(t->tag, "operator"))
+
+	lenv_del(b.builtins);
+	free(b.data);
+	free(b.syms);
+	free(b.index);
+	return err ? err : lval_sexpr();
+}
+
+#ifdef LREAD_MMAP
+// Bind everything in the image at 'path' in e, which has its builtins
+lval* lenv_load_image(lenv* e, char* path)
+{
+	errno = 0;
+	size_t n = 0;
+	char* map = lread_map(path, &n);
+	if (!map)
 	{
-		return lval_opr(t->contents);
+		return lval_err("Could not load image %s: %s", path, errno ? strerror(errno) : "Not an image");
 	}
 
-	// If root(>) or sexpr then create empty list
-	lval* x = NULL;
-	if (strcmp(t->tag, ">") == 0)
+	// Check all of it first, so a bad image binds nothing
+	struct lcache_in in = { map + n, NULL, 0, lenv_new() };
+	struct limage_head head;
+	char* p = map + sizeof(head);
+	uint64_t count = 0;
+	int ok = n >= sizeof(head);
+	if (ok)
+	{
+		memcpy(&head, map, sizeof(head));
+		ok = memcmp(head.magic, LIMAGE_MAGIC, sizeof(head.magic)) == 0
+			&& strncmp(head.version, LISPI_VERSION, sizeof(head.version)) == 0
+			&& head.check == lcache_hash(p, n - sizeof(head))
+			&& lcache_get_uint(&p, in.end, &count);
+	}
+	char* q = p;
+	for (uint64_t i = 0; ok && i < count; ++i)
 	{
-		x = lval_sexpr();
+		q = q < in.end && (*q == 'o' || *q == 'O') ? lcache_skip(q, &in) : NULL;
+		q = q ? lcache_skip(q, &in) : NULL;
+		ok = q != NULL;
 	}
-	if (strstr(t->tag, "sexpr"))
+	if (!ok || q != in.end)
 	{
-		x = lval_sexpr();
+		lenv_del(in.builtins);
+		munmap(map, n);
+		return lval_err("Could not load image %s: %s", path, "Not an image for this version of Lispi");
 	}
-	if (strstr(t->tag, "qexpr"))
+
+	lenv_add_builtins(in.builtins);
+	in.syms = malloc(sizeof(struct lcache_sym) * (in.nsyms + 1));
+	in.nsyms = 0;
+	for (uint64_t i = 0; i < count; ++i)
 	{
-		x = lval_qexpr();
+		lval* k = lcache_read(&p, &in);
+		lval* v = lcache_read(&p, &in);
+		lenv_put(e, k, v);
+		lval_del(k);
+		lval_del(v);
 	}
 
-	// Fill in this list with any valid expression contained within
-	for (int i = 0; i < t->children_num; ++i)
+	lenv_del(in.builtins);
+	free(in.syms);
+	munmap(map, n);
+	return lval_sexpr();
+}
+#else
+lval* lenv_load_image(lenv* e, char* path)
+{
+	return lval_err("Could not load image %s: %s", path, "Not supported on this platform");
+}
+#endif
+
+
+
+int main(int argc, char* argv[])
+{
+	// Interpreter options come before the files to load
+	int first = 1;
+	char* image = NULL;
+	char* dump = NULL;
+	while (first < argc && strncmp(argv[first], "--", 2) == 0)
 	{
-		if (strcmp(t->children[i]->contents, "(") == 0)
+		if (strcmp(argv[first], "--gc") == 0)
 		{
-			continue;
+			// Use the tracing collector instead of reference counts
+			lgc.enabled = 1;
 		}
-		if (strcmp(t->children[i]->contents, ")") == 0)
+		else if (strcmp(argv[first], "--nursery") == 0)
 		{
-			continue;
+			// Allocate evaluation temporaries from the nursery
+			lnursery.enabled = 1;
 		}
-		if (strcmp(t->children[i]->contents, "{") == 0)
+		else if (strcmp(argv[first], "--vm") == 0)
 		{
-			continue;
+			// Compile to bytecode instead of walking the expressions
+			lvm.enabled = 1;
 		}
-		if (strcmp(t->children[i]->contents, "}") == 0)
+		else if (strncmp(argv[first], "--image=", 8) == 0)
 		{
-			continue;
+			// Start with the bindings saved in an image
+			image = argv[first] + 8;
 		}
-		if (strcmp(t->children[i]->tag, "regex") == 0)
+		else if (strncmp(argv[first], "--dump-image=", 13) == 0)
 		{
-			continue;
+			// Save the bindings to an image once the files are loaded
+			dump = argv[first] + 13;
 		}
-		if (strstr(t->children[i]->tag, "comment"))
+		else if (strcmp(argv[first], "--no-cache") == 0)
 		{
-			continue;
+			// Always parse loaded files, neither reading nor writing caches
+			lcache.enabled = 0;
 		}
-		x = lval_add(x, lval_read(t->children[i]));
-
-	}
-
-	return x;
-}
-
-// Loads a file through a string provided
-lval* builtin_load(lenv* e, lval* a)
-{
-	LASSERT_NUM("load", a, 1);
-	LASSERT_TYPE("load", a, 0, LVAL_STR);
-
-	// Parse a file given by string
-	mpc_result_t r;
-	if (mpc_parse_contents(a->cell[0]->str, Lispi, &r))
-	{
-		// Read contents
-		lval* expr = lval_read(r.output);
-		mpc_ast_delete(r.output);
-
-		// Evaluate each expression
-		while (expr->count)
+		else if (strcmp(argv[first], "--cek") == 0)
 		{
-			lval* x = lval_eval(e, lval_pop(expr, 0));
-			
-			// If evaluation leads to error print it
-			if (x->type == LVAL_ERR)
+			// Keep evaluation frames on the heap instead of the C stack
+			lcek.enabled = 1;
+		}
+		else if (strncmp(argv[first], "--max-depth=", 12) == 0)
+		{
+			// Deepest nesting the explicit-stack evaluator allows
+			lcek.limit = atoi(argv[first] + 12);
+			if (lcek.limit <= 0)
 			{
-				lval_println(x);
+				fprintf(stderr, "Invalid depth '%s'\n", argv[first] + 12);
+				return 1;
 			}
-			lval_del(x);
 		}
-
-		// Delete expressions and arguments
-		lval_del(expr);
-		lval_del(a);
-
-		// Return empty list
-		return lval_sexpr();
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", argv[first]);
+			return 1;
+		}
+		first++;
 	}
-	else
-	{
-		// Get parse error as String
-		char* err_msg = mpc_err_string(r.error);
-		mpc_err_delete(r.error);
 
-		// Create a new message using it
-		lval* err = lval_err("Could not load Library %s", err_msg);
-
-		// Clean up and return error
-		free(err_msg);
-		lval_del(a);
-		return err;
+	if (lgc.enabled && lnursery.enabled)
+	{
+		fprintf(stderr, "Options '--gc' and '--nursery' cannot be combined\n");
+		return 1;
 	}
-}
-
-
 
-int main(int argc, char* argv[])
-{
-	// Parsers
-	Number	 = mpc_new("number");
-	Operator = mpc_new("operator");
-	String	 = mpc_new("string");
-	Comment  = mpc_new("comment");
-	Sexpr    = mpc_new("sexpr");
-	Qexpr    = mpc_new("qexpr");
-	Expr     = mpc_new("expr");
-	Lispi    = mpc_new("lispi");
+	if (lcek.enabled && lvm.enabled)
+	{
+		fprintf(stderr, "Options '--cek' and '--vm' cannot be combined\n");
+		return 1;
+	}
 
-	
-	// Define the above parsers
-	mpca_lang(MPC_LANG_DEFAULT,
-		"																			\
-			number	:	/-?[0-9]+/ ;												\
-			operator:	/[a-zA-Z0-9_+\\-*\\/\\\\=<>!%^&]+/ ;						\
-			string	:	/\"(\\\\.|[^\"])*\"/ ;										\
-			comment	:	/;[^\\r\\n]*/ ;												\
-			sexpr	:	'(' <expr>* ')' ;											\
-			qexpr	:	'{' <expr>* '}' ;											\
-			expr	:	<number> | <operator> | <string>							\
-						| <comment>	| <sexpr> | <qexpr> ;							\
-			lispi	:	/^/ <expr>* /$/ ;											\
-		",
-		Number, Operator, String, Comment, Sexpr, Qexpr, Expr, Lispi);
+	// Intern the operators the evaluator checks for
+	lsym_amp = lsym_intern("&", 1, lhash("&", 1));
+	lvm_init();
+	lvec_init();
 
 	// Create a new environment
 	lenv* e = lenv_new();
 	lenv_add_builtins(e);
 
-	// Interactive Prompt
-	if (argc == 1)
+	if (image)
+	{
+		lval* x = lenv_load_image(e, image);
+		if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			lval_println(x);
+			return 1;
+		}
+		lval_del(x);
+	}
+
+	// Interactive Prompt, unless only making an image
+	if (first == argc && !dump)
 	{
 		// Print Welcome message
-		puts("Welcome to Lispi 0.0.1.0");
+		puts("Welcome to Lispi " LISPI_VERSION);
 		puts("Press Ctrl+C to exit!");
 
 
@@ -1521,20 +7633,22 @@ int main(int argc, char* argv[])
 			add_history(input);
 
 			// Attempt to parse the input
-			mpc_result_t r;
-			if (mpc_parse("<stdin>", input, Lispi, &r)) {
-
-				lval* x = lval_eval(e, lval_read(r.output));
+			lval* form = lval_read("<stdin>", input, strlen(input));
+			if (LVAL_TYPE(form) != LVAL_ERR)
+			{
+				lnursery_begin();
+				lval* x = lvm.enabled ? lvm_eval(e, form) : lval_eval(e, form);
 				lval_println(x);
 				lval_del(x);
+				lnursery_end();
 
-				mpc_ast_delete(r.output);
+				lgc_safepoint(e);
 			}
 			else
 			{
 				// Otherwise print the error
-				mpc_err_print(r.error);
-				mpc_err_delete(r.error);
+				puts(form->err);
+				lval_del(form);
 			}
 
 			// Free the input buffer
@@ -1544,10 +7658,10 @@ int main(int argc, char* argv[])
 	}
 
 	// Supplied with list of files
-	if(argc >= 2)
+	if(first < argc)
 	{
 		// Loop over each supplied filename
-		for (int i = 1; i < argc; ++i)
+		for (int i = first; i < argc; ++i)
 		{
 			// Argument list with a single argument, the filename
 			lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
@@ -1556,7 +7670,7 @@ int main(int argc, char* argv[])
 			lval* x = builtin_load(e, args);
 
 			// If the result is an error be sure to print it
-			if (x->type == LVAL_ERR)
+			if (LVAL_TYPE(x) == LVAL_ERR)
 			{
 				lval_println(x);
 			}
@@ -1565,12 +7679,18 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if (dump)
+	{
+		lval* x = lenv_dump_image(e, dump);
+		if (LVAL_TYPE(x) == LVAL_ERR)
+		{
+			lval_println(x);
+			return 1;
+		}
+		lval_del(x);
+	}
+
 	// Delete the environment
 	lenv_del(e);
-
-	// Undefine and delete our parsers
-	mpc_cleanup(8,
-		Number, Operator, String, Comment,
-		Sexpr, Qexpr, Expr, Lispi);
 	return 0;
 }
\ No newline at end of file